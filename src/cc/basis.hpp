@@ -0,0 +1,397 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <Eigen/Dense>
+
+// One basis function of a Molden file, the cartesian powers lx, ly, lz (at
+// most p) times a contraction of Gaussians $$e^{-\alpha r^2}$$, or of one Slater
+// function $$r^n e^{-\zeta r}$$. The normalization is folded into the coefficients
+template<typename T>
+struct BasisFunction {
+    int atom;
+    bool slater;
+    int lx, ly, lz, n;
+    std::vector<T> exponents, coefs;
+};
+
+// Atoms, basis functions and MO coefficients read from a Molden file, the
+// sections [Atoms] (AU or Angs), [GTO] (s and p shells), [STO] and [MO]
+template<typename T>
+class MoldenFile {
+public:
+    typedef Eigen::Matrix<T, 1, 3> Coord;
+
+    std::vector<Coord> atoms;
+    std::vector<int> charges;
+    std::vector<BasisFunction<T>> functions;
+    // mo[i][j], coefficient of the basis function j in the orbital i
+    std::vector<std::vector<T>> mo;
+    std::vector<T> mo_energy, mo_occupation;
+    // FNV-1a of the file, to tell the files apart in the result cache
+    uint64_t checksum = 14695981039346656037ULL;
+
+    static MoldenFile load(const std::string& path) {
+        std::ifstream is(path);
+        if(!is) throw std::runtime_error("Cannot open the basis file " + path);
+        return read(is);
+    }
+
+    static MoldenFile read(std::istream& is) {
+        MoldenFile ret;
+        std::string line, section;
+        std::vector<std::pair<int, std::string>> gto_lines;
+        bool angstrom = false;
+        while(std::getline(is, line)) {
+            for(unsigned char ch: line) {
+                ret.checksum ^= ch;
+                ret.checksum *= 1099511628211ULL;
+            }
+            auto start = line.find_first_not_of(" \t\r");
+            if(start == std::string::npos) {
+                if(section == "[GTO]") gto_lines.push_back({0, ""});
+                continue;
+            }
+            if(line[start] == '[') {
+                // the functions keep the order of the file
+                ret.read_gto(gto_lines);
+                gto_lines.clear();
+                auto end = line.find(']', start);
+                section = upper(line.substr(start, end - start + 1));
+                if(section == "[ATOMS]") angstrom = upper(line).find("ANGS") != std::string::npos;
+                continue;
+            }
+            if(section == "[ATOMS]") ret.read_atom(line, angstrom);
+            else if(section == "[GTO]") gto_lines.push_back({1, line});
+            else if(section == "[STO]") ret.read_sto(line);
+            else if(section == "[MO]") ret.read_mo(line);
+        }
+        ret.read_gto(gto_lines);
+        for(auto& c: ret.mo) c.resize(ret.functions.size(), 0);
+        if(ret.atoms.empty()) throw std::runtime_error("No [Atoms] in the basis file");
+        if(ret.functions.empty()) throw std::runtime_error("No [GTO] or [STO] basis in the basis file");
+        if(ret.mo.empty()) throw std::runtime_error("No [MO] in the basis file");
+        for(auto& f: ret.functions) {
+            if(f.atom < 0 || f.atom >= static_cast<int>(ret.atoms.size())) {
+                throw std::runtime_error("Basis function on an unknown atom");
+            }
+        }
+        return ret;
+    }
+
+private:
+    bool mo_values = false;
+
+    static std::string upper(std::string s) {
+        for(auto& ch: s) ch = std::toupper(static_cast<unsigned char>(ch));
+        return s;
+    }
+
+    // Fortran exponents, 1.0D-01
+    static T number(std::string s) {
+        for(auto& ch: s) if(ch == 'D' || ch == 'd') ch = 'E';
+        return static_cast<T>(std::stod(s));
+    }
+
+    void read_atom(const std::string& line, bool angstrom) {
+        std::istringstream ls(line);
+        std::string name, x, y, z;
+        int index, charge;
+        if(!(ls >> name >> index >> charge >> x >> y >> z)) throw std::runtime_error("Invalid atom: " + line);
+        Coord r;
+        r << number(x), number(y), number(z);
+        if(angstrom) r /= 0.52917721092;
+        atoms.push_back(r);
+        charges.push_back(charge);
+    }
+
+    // atom a b c d zeta coef: coef x^a y^b z^c r^d e^{-zeta r}
+    void read_sto(const std::string& line) {
+        std::istringstream ls(line);
+        BasisFunction<T> f;
+        std::string zeta, coef;
+        if(!(ls >> f.atom >> f.lx >> f.ly >> f.lz >> f.n >> zeta >> coef)) {
+            throw std::runtime_error("Invalid STO: " + line);
+        }
+        if(f.lx + f.ly + f.lz > 1) throw std::runtime_error("Only s and p Slater functions are supported");
+        f.atom--;
+        f.slater = true;
+        f.exponents = {number(zeta)};
+        f.coefs = {number(coef)};
+        functions.push_back(f);
+    }
+
+    // "Sym=", "Ene=", "Spin=", "Occup=" start an orbital, then "index coef"
+    void read_mo(const std::string& line) {
+        auto eq = line.find('=');
+        if(eq != std::string::npos) {
+            if(mo_values || mo.empty()) {
+                mo.emplace_back();
+                mo_energy.push_back(0);
+                mo_occupation.push_back(0);
+                mo_values = false;
+            }
+            auto key = upper(line.substr(0, eq));
+            if(key.find("ENE") != std::string::npos) mo_energy.back() = number(line.substr(eq + 1));
+            if(key.find("OCCUP") != std::string::npos) mo_occupation.back() = number(line.substr(eq + 1));
+            return;
+        }
+        if(mo.empty()) throw std::runtime_error("MO coefficient before the orbital header: " + line);
+        std::istringstream ls(line);
+        int index;
+        std::string coef;
+        if(!(ls >> index >> coef) || index < 1) throw std::runtime_error("Invalid MO coefficient: " + line);
+        if(static_cast<int>(mo.back().size()) < index) mo.back().resize(index, 0);
+        mo.back()[index - 1] = number(coef);
+        mo_values = true;
+    }
+
+    // Blocks of "atom 0", then shells "l nprim scale" with nprim lines
+    // "exponent coef", a blank line ends the atom. The coefficients are
+    // those of normalized primitives, the contraction is normalized again
+    void read_gto(const std::vector<std::pair<int, std::string>>& lines) {
+        int atom = -1;
+        for(size_t i=0; i<lines.size(); i++) {
+            if(!lines[i].first) {
+                atom = -1;
+                continue;
+            }
+            std::istringstream ls(lines[i].second);
+            if(atom < 0) {
+                if(!(ls >> atom)) throw std::runtime_error("Invalid GTO atom: " + lines[i].second);
+                atom--;
+                continue;
+            }
+            std::string shell, scale_str = "1.0";
+            int nprim;
+            if(!(ls >> shell >> nprim)) throw std::runtime_error("Invalid GTO shell: " + lines[i].second);
+            ls >> scale_str;
+            auto scale = number(scale_str);
+            shell = upper(shell);
+            int l;
+            if(shell == "S") l = 0;
+            else if(shell == "P") l = 1;
+            else throw std::runtime_error("Unsupported GTO shell " + shell + ", only s and p");
+            std::vector<T> exponents, coefs;
+            for(int p=0; p<nprim; p++) {
+                if(++i >= lines.size() || !lines[i].first) throw std::runtime_error("Missing GTO primitives");
+                std::istringstream ps(lines[i].second);
+                std::string a, c;
+                if(!(ps >> a >> c)) throw std::runtime_error("Invalid GTO primitive: " + lines[i].second);
+                exponents.push_back(number(a)*scale*scale);
+                coefs.push_back(number(c));
+            }
+            // $$N = (2\alpha/\pi)^{3/4} (4\alpha)^{l/2}$$ and the norm of the contraction
+            T norm = 0;
+            for(int a=0; a<nprim; a++) {
+                for(int b=0; b<nprim; b++) {
+                    auto p = exponents[a] + exponents[b];
+                    auto na = std::pow(2*exponents[a]/M_PI, 0.75)*std::pow(4*exponents[a], 0.5*l);
+                    auto nb = std::pow(2*exponents[b]/M_PI, 0.75)*std::pow(4*exponents[b], 0.5*l);
+                    norm += coefs[a]*coefs[b]*na*nb*std::pow(M_PI/p, 1.5)*std::pow(0.5/p, l);
+                }
+            }
+            for(int a=0; a<nprim; a++) {
+                coefs[a] *= std::pow(2*exponents[a]/M_PI, 0.75)*std::pow(4*exponents[a], 0.5*l)/std::sqrt(norm);
+            }
+            // Molden order of the p functions: x, y, z
+            for(int m=0; m<(l ? 3 : 1); m++) {
+                BasisFunction<T> f;
+                f.atom = atom;
+                f.slater = false;
+                f.lx = l && m == 0;
+                f.ly = l && m == 1;
+                f.lz = l && m == 2;
+                f.n = 0;
+                f.exponents = exponents;
+                f.coefs = coefs;
+                functions.push_back(f);
+            }
+        }
+    }
+};
+
+// One molecular orbital of a basis set on the given centers. The MO and
+// contraction coefficients are folded into one row per distinct primitive
+// and atom, $$c_0 + c_x x + c_y y + c_z z$$ times the radial part, so that
+// the s and p functions of a shell share the exponential. The rows of an
+// atom are sorted by exponent, an electron evaluates them as Eigen arrays,
+// one segment per atom, cut where $$\alpha r^2$$ ($$\zeta r$$) exceeds the
+// screening cutoff. Far from an atom only its diffuse primitives are left.
+template<typename T>
+class BasisOrbital {
+public:
+    typedef Eigen::Matrix<T, 1, 3> Coord;
+    typedef Eigen::Array<T, Eigen::Dynamic, 1> Array;
+
+    // the primitives below exp(-cutoff) are skipped, an infinite cutoff keeps all
+    BasisOrbital(const MoldenFile<T>& file, int orbital, const std::vector<Coord>& centers, T cutoff=36.0):
+        centers(centers), cutoff(cutoff) {
+        if(orbital < 0 || orbital >= static_cast<int>(file.mo.size())) {
+            throw std::runtime_error("No orbital " + std::to_string(orbital) + " in the basis file");
+        }
+        if(centers.size() != file.atoms.size()) throw std::runtime_error("Need one center per atom of the basis");
+        // (atom, slater, n, exponent) -> coefficients c0, cx, cy, cz
+        std::map<std::tuple<int, bool, int, T>, Eigen::Matrix<T, 4, 1>> rows;
+        for(size_t j=0; j<file.functions.size(); j++) {
+            auto& f = file.functions[j];
+            auto c = file.mo[orbital][j];
+            if(c == 0) continue;
+            int comp = f.lx ? 1 : f.ly ? 2 : f.lz ? 3 : 0;
+            for(size_t p=0; p<f.exponents.size(); p++) {
+                auto key = std::make_tuple(f.atom, f.slater, f.n, f.exponents[p]);
+                if(!rows.count(key)) rows[key].setZero();
+                rows[key](comp) += c*f.coefs[p];
+            }
+        }
+        auto n = rows.size();
+        exponent.resize(n);
+        power.resize(n);
+        c0.resize(n);
+        cx.resize(n);
+        cy.resize(n);
+        cz.resize(n);
+        // the map is ordered by atom, type and exponent, a segment per atom and type
+        Eigen::Index i = 0;
+        for(auto& row: rows) {
+            int atom, npow;
+            bool slater;
+            T alpha;
+            std::tie(atom, slater, npow, alpha) = row.first;
+            if(segments.empty() || segments.back().atom != atom || segments.back().slater != slater) {
+                segments.push_back({atom, slater, i, i});
+            }
+            exponent(i) = alpha;
+            power(i) = npow;
+            c0(i) = row.second(0);
+            cx(i) = row.second(1);
+            cy(i) = row.second(2);
+            cz(i) = row.second(3);
+            segments.back().end = ++i;
+        }
+        // rows of one Slater segment may differ in n, sort them by exponent
+        for(auto& s: segments) {
+            if(!s.slater) continue;
+            std::vector<Eigen::Index> order(s.end - s.begin);
+            for(size_t k=0; k<order.size(); k++) order[k] = s.begin + k;
+            std::stable_sort(order.begin(), order.end(),
+                             [&](Eigen::Index a, Eigen::Index b) { return exponent(a) < exponent(b); });
+            for(auto arr: {&exponent, &power, &c0, &cx, &cy, &cz}) {
+                Array copy = *arr;
+                for(size_t k=0; k<order.size(); k++) (*arr)(s.begin + k) = copy(order[k]);
+            }
+        }
+    }
+
+    size_t primitives() const {
+        return exponent.size();
+    }
+
+    T value(const Coord& r) const {
+        T val = 0;
+        for(auto& s: segments) {
+            Coord d = r - centers[s.atom];
+            auto r2 = d.squaredNorm();
+            auto end = screen(s, r2);
+            auto m = end - s.begin;
+            if(m == 0) continue;
+            auto a = exponent.segment(s.begin, m);
+            Array poly = c0.segment(s.begin, m) + cx.segment(s.begin, m)*d(0)
+                       + cy.segment(s.begin, m)*d(1) + cz.segment(s.begin, m)*d(2);
+            if(s.slater) {
+                auto dist = std::sqrt(r2);
+                // r^0 = 1 also on the nucleus, where 0*log(0) is NaN
+                auto n = power.segment(s.begin, m);
+                val += (poly*((n == 0).select(0, n*std::log(dist)) - a*dist).exp()).sum();
+            } else {
+                val += (poly*(-a*r2).exp()).sum();
+            }
+        }
+        return val;
+    }
+
+    // value, gradient and laplacian in one pass, the gradient of the part
+    // centered on every atom in atom_grad if given (for the nuclear gradients)
+    void evaluate(const Coord& r, T& val, Coord& grad, T& lap, std::vector<Coord>* atom_grad=nullptr) const {
+        val = 0;
+        lap = 0;
+        grad.setZero();
+        if(atom_grad) atom_grad->assign(centers.size(), Coord::Zero());
+        for(auto& s: segments) {
+            Coord d = r - centers[s.atom];
+            auto r2 = d.squaredNorm();
+            auto end = screen(s, r2);
+            auto m = end - s.begin;
+            if(m == 0) continue;
+            auto a = exponent.segment(s.begin, m);
+            auto x = cx.segment(s.begin, m), y = cy.segment(s.begin, m), z = cz.segment(s.begin, m);
+            Array cd = x*d(0) + y*d(1) + z*d(2);
+            Array poly = c0.segment(s.begin, m) + cd;
+            Coord g;
+            if(s.slater && r2 == 0) {
+                // on the nucleus only the n = 0 terms are nonzero. The radial
+                // gradient has no direction and is left out, the cusp of
+                // e^{-zeta r} makes the Laplacian -inf, as in AtomicWaveFn
+                auto n = power.segment(s.begin, m);
+                g.setZero();
+                for(Eigen::Index j=0; j<m; j++) {
+                    if(n(j) != 0) continue;
+                    val += poly(j);
+                    g += Coord(x(j), y(j), z(j));
+                    if(poly(j) != 0) lap -= poly(j)*a(j)*std::numeric_limits<T>::infinity();
+                }
+            } else if(s.slater) {
+                // R = r^n e^{-zeta r}, R' = k R, k = n/r - zeta
+                auto dist = std::sqrt(r2);
+                auto n = power.segment(s.begin, m);
+                Array radial = (n*std::log(dist) - a*dist).exp();
+                Array k = n/dist - a;
+                val += (poly*radial).sum();
+                auto kp = (radial*k*poly).sum()/dist;
+                g << (radial*x).sum() + kp*d(0), (radial*y).sum() + kp*d(1), (radial*z).sum() + kp*d(2);
+                lap += (radial*(poly*(k*k - n/r2 + 2*k/dist) + 2*k*cd/dist)).sum();
+            } else {
+                // $$\nabla^2 (gP) = g[(4\alpha^2 r^2 - 6\alpha)P - 4\alpha\,\mathbf{c}\cdot\mathbf{d}]$$
+                Array gauss = (-a*r2).exp();
+                Array ag = a*gauss;
+                val += (poly*gauss).sum();
+                auto ap = (ag*poly).sum();
+                g << (gauss*x).sum() - 2*ap*d(0), (gauss*y).sum() - 2*ap*d(1), (gauss*z).sum() - 2*ap*d(2);
+                lap += 4*r2*(a*ag*poly).sum() - 6*ap - 4*(ag*cd).sum();
+            }
+            grad += g;
+            if(atom_grad) (*atom_grad)[s.atom] += g;
+        }
+    }
+
+private:
+    struct Segment {
+        int atom;
+        bool slater;
+        Eigen::Index begin, end;
+    };
+
+    std::vector<Coord> centers;
+    T cutoff;
+    std::vector<Segment> segments;
+    Array exponent, power, c0, cx, cy, cz;
+
+    // end of the rows of s with alpha r^2 (zeta r) below the cutoff
+    inline Eigen::Index screen(const Segment& s, T r2) const {
+        auto x = s.slater ? std::sqrt(r2) : r2;
+        if(x*exponent(s.begin) >= cutoff) return s.begin;
+        if(x*exponent(s.end - 1) < cutoff) return s.end;
+        auto first = exponent.data() + s.begin;
+        return s.begin + (std::lower_bound(first, exponent.data() + s.end, cutoff/x) - first);
+    }
+};
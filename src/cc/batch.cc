@@ -0,0 +1,67 @@
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <fmt/core.h>
+#include <cxxopts.hpp>
+#include "batch.hpp"
+
+int main(int argc, char** argv) {
+    cxxopts::Options options("BatchQMC", "Run a job file of Quantum Monte Carlo calculations");
+    options.add_options()
+        ("j,jobs", "Job file, one calculation per line", cxxopts::value<std::string>())
+        ("o,output", "Output file, .json or .csv", cxxopts::value<std::string>()->default_value("results.json"))
+        ("t,threads", "Number of threads, 0 for all cores", cxxopts::value<int>()->default_value("0"))
+        ("seed", "Master seed of the random number service", cxxopts::value<unsigned>()->default_value("2021"))
+        ("h,help", "Print usage")
+    ;
+    auto result = options.parse(argc, argv);
+    if(result.count("help") || !result.count("jobs")) {
+        fmt::print("{}\n", options.help());
+        exit(0);
+    }
+
+    auto jobs_path = result["jobs"].as<std::string>();
+    std::ifstream input(jobs_path);
+    if(!input) {
+        fmt::print(stderr, "Cannot open job file {}\n", jobs_path);
+        return 1;
+    }
+    std::vector<Job> jobs;
+    try {
+        jobs = read_jobs(input);
+    } catch(const std::exception& e) {
+        fmt::print(stderr, "{}: {}\n", jobs_path, e.what());
+        return 1;
+    }
+
+    // before the jobs run, so that they are not lost
+    auto path = result["output"].as<std::string>();
+    std::ofstream output(path);
+    if(!output) {
+        fmt::print(stderr, "Cannot open output file {}\n", path);
+        return 1;
+    }
+
+    auto nthread = result["threads"].as<int>();
+    if(nthread <= 0) nthread = std::max(1u, std::thread::hardware_concurrency());
+    RngService rng(result["seed"].as<unsigned>());
+    auto results = run_jobs(jobs, rng, nthread);
+
+    if(path.size() >= 4 && path.substr(path.size() - 4) == ".csv") write_csv(output, results);
+    else write_json(output, results);
+    output.close();
+    if(!output) {
+        fmt::print(stderr, "Cannot write output file {}\n", path);
+        return 1;
+    }
+
+    int nfail = 0;
+    for(auto& r: results) {
+        if(!r.error.empty()) {
+            fmt::print(stderr, "Job {} failed: {}\n", r.name, r.error);
+            nfail++;
+        }
+    }
+    return nfail ? 1 : 0;
+}
@@ -0,0 +1,350 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fmt/core.h>
+#include "heg.hpp"
+#include "hydrogen.hpp"
+#include "simple_qmc.hpp"
+
+// A number of the job file, the whole value has to parse
+inline double parse_number(const std::string& key, const std::string& val) {
+    size_t pos = 0;
+    double ret = 0.0;
+    try {
+        ret = std::stod(val, &pos);
+    } catch(const std::exception&) {
+        pos = std::string::npos;
+    }
+    if(pos != val.size()) throw std::runtime_error("Invalid number " + key + "=" + val);
+    return ret;
+}
+
+inline long parse_integer(const std::string& key, const std::string& val) {
+    size_t pos = 0;
+    long ret = 0;
+    try {
+        ret = std::stol(val, &pos);
+    } catch(const std::exception&) {
+        pos = std::string::npos;
+    }
+    if(pos != val.size()) throw std::runtime_error("Invalid integer " + key + "=" + val);
+    return ret;
+}
+
+// One calculation of the job file, a line of whitespace separated key=value pairs
+// e.g. "name=h2_14 system=h2 jastrow=en-pade b=0.3 r1=0.7,0,0 r2=-0.7,0,0 nstep=100000 seed=1"
+// system is hydrogen (NaiveQMC), h2 (H2MolQMC) or heg (HEGQMC, keys nshell, rs, step),
+// the remaining keys are the command line options of simple_qmc.x and hydrogen.x
+struct Job {
+    std::string name;
+    std::string system;
+    int nstep = 1000000;
+    unsigned seed = 0;
+    std::map<std::string, std::string> params;
+
+    double get(const std::string& key, double def) const {
+        auto it = params.find(key);
+        if(it == params.end()) return def;
+        return parse_number(key, it->second);
+    }
+
+    // a count of at least 1, e.g. nshell
+    int get(const std::string& key, int def) const {
+        auto it = params.find(key);
+        if(it == params.end()) return def;
+        auto n = parse_integer(key, it->second);
+        if(n < 1 || n > std::numeric_limits<int>::max()) throw std::runtime_error("Invalid " + key + "=" + it->second);
+        return static_cast<int>(n);
+    }
+
+    std::string get(const std::string& key, const std::string& def) const {
+        auto it = params.find(key);
+        if(it == params.end()) return def;
+        return it->second;
+    }
+
+    PCoord<double> get(const std::string& key, const PCoord<double>& def) const {
+        auto it = params.find(key);
+        if(it == params.end()) return def;
+        std::string val = it->second;
+        for(auto& ch: val) if(ch == ',') ch = ' ';
+        std::istringstream is(val);
+        PCoord<double> ret;
+        std::string rest;
+        if(!(is >> ret(0) >> ret(1) >> ret(2)) || (is >> rest)) {
+            throw std::runtime_error("Invalid coordinate " + key + "=" + it->second);
+        }
+        return ret;
+    }
+};
+
+// The parameters every system takes, other keys are an error
+inline const std::vector<std::string>& system_keys(const std::string& system) {
+    static const std::map<std::string, std::vector<std::string>> keys = {
+        {"hydrogen", {"c", "alpha", "step"}},
+        {"h2", {"jastrow", "F", "a", "b", "aen", "ben", "c", "alpha", "step", "r1", "r2"}},
+        {"heg", {"nshell", "rs", "step"}}
+    };
+    auto it = keys.find(system);
+    if(it == keys.end()) throw std::runtime_error("Invalid system " + system);
+    return it->second;
+}
+
+// Seed of a job without seed=, FNV-1a of its name, so that the jobs get
+// different streams and a job keeps its stream when the file is reordered
+inline unsigned name_seed(const std::string& name) {
+    uint32_t h = 2166136261u;
+    for(unsigned char ch: name) {
+        h ^= ch;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+struct JobResult {
+    std::string name;
+    std::string system;
+    unsigned seed;
+    int nstep;
+    double energy = 0.0;
+    double energy_std = 0.0;
+    double accept = 0.0;
+    double seconds = 0.0;
+    std::string error;
+};
+
+// Read the jobs, blank lines and lines starting with # are skipped. Every
+// error names the line, the names have to be unique
+inline std::vector<Job> read_jobs(std::istream& is) {
+    std::vector<Job> jobs;
+    std::map<std::string, int> names;
+    std::string line;
+    int lineno = 0;
+    while(std::getline(is, line)) {
+        lineno++;
+        auto pos = line.find('#');
+        if(pos != std::string::npos) line = line.substr(0, pos);
+        std::istringstream ls(line);
+        std::string item;
+        Job job;
+        bool empty = true, seeded = false;
+        try {
+            while(ls >> item) {
+                empty = false;
+                auto eq = item.find('=');
+                if(eq == std::string::npos) throw std::runtime_error("expect key=value, got " + item);
+                auto key = item.substr(0, eq);
+                auto val = item.substr(eq + 1);
+                if(key == "name") job.name = val;
+                else if(key == "system") job.system = val;
+                else if(key == "nstep") {
+                    auto n = parse_integer(key, val);
+                    if(n <= 0 || n > std::numeric_limits<int>::max()) throw std::runtime_error("Invalid nstep=" + val);
+                    job.nstep = static_cast<int>(n);
+                } else if(key == "seed") {
+                    auto n = parse_integer(key, val);
+                    if(n < 0 || n > std::numeric_limits<unsigned>::max()) throw std::runtime_error("Invalid seed=" + val);
+                    job.seed = static_cast<unsigned>(n);
+                    seeded = true;
+                } else if(!job.params.insert({key, val}).second) {
+                    throw std::runtime_error("Repeated key " + key);
+                }
+            }
+            if(empty) continue;
+            // every parameter is one of the system and parses
+            auto& keys = system_keys(job.system);
+            for(auto& kv: job.params) {
+                if(std::find(keys.begin(), keys.end(), kv.first) == keys.end()) {
+                    throw std::runtime_error(fmt::format("Unknown key {} for system {}", kv.first, job.system));
+                }
+                if(kv.first == "jastrow") parse_jastrow(kv.second);
+                else if(kv.first == "r1" || kv.first == "r2") job.get(kv.first, PCoord<double>::Zero().eval());
+                else if(kv.first == "nshell") job.get(kv.first, 1);
+                else job.get(kv.first, 0.0);
+            }
+            // and of its Jastrow factor, the others would run silently with the defaults
+            if(job.system == "h2") {
+                auto jastrow = job.get("jastrow", "simple");
+                auto& used = jastrow_params(parse_jastrow(jastrow));
+                for(std::string key: {"F", "a", "b", "aen", "ben"}) {
+                    if(job.params.count(key) && std::find(used.begin(), used.end(), key) == used.end()) {
+                        throw std::runtime_error(fmt::format("The {} Jastrow factor has no parameter {}", jastrow, key));
+                    }
+                }
+            }
+            if(job.name.empty()) job.name = fmt::format("job{}", jobs.size());
+            if(!names.insert({job.name, lineno}).second) {
+                throw std::runtime_error(fmt::format("Name {} already used on line {}", job.name, names[job.name]));
+            }
+            if(!seeded) job.seed = name_seed(job.name);
+        } catch(const std::exception& e) {
+            throw std::runtime_error(fmt::format("Line {}: {}", lineno, e.what()));
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+// Seeds of all the jobs derive from one master seed, so that a batch is
+// reproducible, while different job seeds give independent streams.
+// It is stateless and shared by all the worker threads
+class RngService {
+public:
+    RngService(unsigned master): master(master) {}
+
+    unsigned seed(unsigned job_seed) const {
+        std::seed_seq seq {master, job_seed};
+        unsigned ret;
+        seq.generate(&ret, &ret + 1);
+        return ret;
+    }
+
+private:
+    unsigned master;
+};
+
+template<JastrowType Jastrow>
+std::pair<double, double> run_h2(const Job& job, unsigned seed, double& accept) {
+    JastrowParam<double> param(job.get("F", 1.0), job.get("a", 0.5), job.get("b", 0.3),
+                               job.get("aen", 0.2), job.get("ben", 1.5));
+    PCoord<double> r1, r2;
+    r1 << 0.5, 0.0, 0.0;
+    r2 << -0.5, 0.0, 0.0;
+    H2MolQMC<double, Jastrow> sampler(param, job.get("c", 0.0), job.get("alpha", 1.0),
+                                      job.get("r1", r1), job.get("r2", r2), job.get("step", 1.0));
+    sampler.seed(seed);
+    sampler.set_verbose(false);
+    auto ret = sampler.sample(job.nstep);
+    accept = sampler.accept_ratio();
+    return ret;
+}
+
+inline JobResult run_job(const Job& job, const RngService& rng) {
+    JobResult ret;
+    ret.name = job.name;
+    ret.system = job.system;
+    ret.seed = job.seed;
+    ret.nstep = job.nstep;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        auto seed = rng.seed(job.seed);
+        if(job.system == "hydrogen") {
+            NaiveQMC<double> sampler(job.get("c", 0.0), job.get("alpha", 1.0), job.get("step", 1.0));
+            sampler.seed(seed);
+            std::tie(ret.energy, ret.energy_std) = sampler.sample(job.nstep);
+            ret.accept = sampler.accept_ratio();
+        } else if(job.system == "heg") {
+            // one step moves every electron, the energy is per electron
+            HEGQMC<double> sampler(job.get("nshell", 2), job.get("rs", 2.0), job.get("step", 0.5));
+            sampler.seed(seed);
+            sampler.set_verbose(false);
+            std::tie(ret.energy, ret.energy_std) = sampler.sample(job.nstep);
+            ret.accept = sampler.accept_ratio();
+        } else {
+            switch(parse_jastrow(job.get("jastrow", "simple"))) {
+                case JastrowType::SIMPLE_JASTROW:
+                    std::tie(ret.energy, ret.energy_std) = run_h2<JastrowType::SIMPLE_JASTROW>(job, seed, ret.accept);
+                    break;
+                case JastrowType::PADE_JASTROW:
+                    std::tie(ret.energy, ret.energy_std) = run_h2<JastrowType::PADE_JASTROW>(job, seed, ret.accept);
+                    break;
+                case JastrowType::EN_PADE_JASTROW:
+                    std::tie(ret.energy, ret.energy_std) = run_h2<JastrowType::EN_PADE_JASTROW>(job, seed, ret.accept);
+                    break;
+            }
+        }
+    } catch(const std::exception& e) {
+        ret.error = e.what();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    ret.seconds = std::chrono::duration<double>(stop - start).count();
+    return ret;
+}
+
+// Run all the jobs on a pool of nthread workers, which take the next job
+// from a shared counter, the results keep the order of the jobs
+inline std::vector<JobResult> run_jobs(const std::vector<Job>& jobs, const RngService& rng, int nthread) {
+    std::vector<JobResult> results(jobs.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for(auto i = next++; i < jobs.size(); i = next++) {
+            results[i] = run_job(jobs[i], rng);
+        }
+    };
+    std::vector<std::thread> pool;
+    for(int i=1; i<nthread; i++) pool.emplace_back(worker);
+    worker();
+    for(auto& t: pool) t.join();
+    return results;
+}
+
+// RFC 8259 string, the control characters as escapes
+inline std::string json_escape(const std::string& str) {
+    std::string ret;
+    for(unsigned char ch: str) {
+        switch(ch) {
+            case '"': ret += "\\\""; break;
+            case '\\': ret += "\\\\"; break;
+            case '\b': ret += "\\b"; break;
+            case '\f': ret += "\\f"; break;
+            case '\n': ret += "\\n"; break;
+            case '\r': ret += "\\r"; break;
+            case '\t': ret += "\\t"; break;
+            default:
+                if(ch < 0x20) ret += fmt::format("\\u{:04x}", ch);
+                else ret += ch;
+        }
+    }
+    return ret;
+}
+
+// JSON has no NaN or infinity, they are null
+inline std::string json_number(double val, int precision) {
+    if(!std::isfinite(val)) return "null";
+    return fmt::format("{:.{}g}", val, precision);
+}
+
+// RFC 4180 field, quoted with the quotes doubled when it holds a comma, quote or line break
+inline std::string csv_escape(const std::string& str) {
+    if(str.find_first_of(",\"\r\n") == std::string::npos) return str;
+    std::string ret = "\"";
+    for(auto ch: str) {
+        if(ch == '"') ret += '"';
+        ret += ch;
+    }
+    return ret + "\"";
+}
+
+inline void write_csv(std::ostream& os, const std::vector<JobResult>& results) {
+    os << "name,system,seed,nstep,energy,energy_std,accept,seconds,error\n";
+    for(auto& r: results) {
+        os << fmt::format("{},{},{},{},{:.10g},{:.10g},{:.6f},{:.6f},{}\n", csv_escape(r.name), csv_escape(r.system),
+                          r.seed, r.nstep, r.energy, r.energy_std, r.accept, r.seconds, csv_escape(r.error));
+    }
+}
+
+inline void write_json(std::ostream& os, const std::vector<JobResult>& results) {
+    os << "[\n";
+    for(size_t i=0; i<results.size(); i++) {
+        auto& r = results[i];
+        os << fmt::format("  {{\"name\": \"{}\", \"system\": \"{}\", \"seed\": {}, \"nstep\": {}, "
+                          "\"energy\": {}, \"energy_std\": {}, \"accept\": {}, "
+                          "\"seconds\": {}, \"error\": \"{}\"}}{}\n",
+                          json_escape(r.name), json_escape(r.system), r.seed, r.nstep, json_number(r.energy, 10),
+                          json_number(r.energy_std, 10), json_number(r.accept, 6), json_number(r.seconds, 6),
+                          json_escape(r.error), i+1 < results.size() ? "," : "");
+    }
+    os << "]\n";
+}
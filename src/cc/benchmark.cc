@@ -0,0 +1,328 @@
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <fmt/core.h>
+#include "hydrogen.hpp"
+#include "heg.hpp"
+#include "multidet.hpp"
+#include "simple_qmc.hpp"
+
+// Return the time (ns) per call of func over npoint points, repeated nrepeat times
+template<typename Fn>
+double timeit(Fn func, int npoint, int nrepeat=20) {
+    auto start = std::chrono::steady_clock::now();
+    for(int n=0; n<nrepeat; n++) {
+        for(int i=0; i<npoint; i++) func(i);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count()/(nrepeat*npoint);
+}
+
+void bench_autodiff(int npoint) {
+    std::vector<PCoord<double>> r1(npoint), r2(npoint);
+    for(int i=0; i<npoint; i++) {
+        r1[i] = 2.0*PCoord<double>::Random();
+        r2[i] = 2.0*PCoord<double>::Random();
+    }
+    double sink = 0.0;
+
+    AtomicWaveFn<double> atomic(0.5, 1.0);
+    ADWaveFn<double, AtomicOrbital<double>> atomic_ad(AtomicOrbital<double>{0.5, 1.0});
+    auto t_atomic = timeit([&](int i) {
+        sink += atomic.value(r1[i]) + atomic.grad(r1[i])(0) + atomic.laplace(r1[i]);
+    }, npoint);
+    auto t_atomic_ad = timeit([&](int i) {
+        double val, lap;
+        PCoord<double> grad;
+        atomic_ad.evaluate(r1[i], val, grad, lap);
+        sink += val + grad(0) + lap;
+    }, npoint);
+
+    JastrowWfn<double> jastrow(1.0);
+    ADJastrowWfn<double, SimpleJastrow<double>> jastrow_ad(SimpleJastrow<double>{1.0});
+    auto t_jastrow = timeit([&](int i) {
+        auto grad = jastrow.grad(r1[i], r2[i]);
+        auto lap = jastrow.laplace(r1[i], r2[i]);
+        sink += jastrow.value(r1[i], r2[i]) + grad.first(0) + lap.first;
+    }, npoint);
+    auto t_jastrow_ad = timeit([&](int i) {
+        double val, lap1, lap2;
+        PCoord<double> grad1, grad2;
+        jastrow_ad.evaluate(r1[i], r2[i], val, grad1, grad2, lap1, lap2);
+        sink += val + grad1(0) + lap1;
+    }, npoint);
+
+    fmt::print("Value/grad/laplace, ns per evaluation (checksum {:g})\n", sink);
+    fmt::print("{:>20s}\t{:>12s}\t{:>12s}\n", "Wave function", "Hand-coded", "Autodiff");
+    fmt::print("{:>20s}\t{:>12.2f}\t{:>12.2f}\n", "AtomicWaveFn", t_atomic, t_atomic_ad);
+    fmt::print("{:>20s}\t{:>12.2f}\t{:>12.2f}\n", "JastrowWfn", t_jastrow, t_jastrow_ad);
+}
+
+void bench_walkers(int nwalker, int maxstep) {
+    PCoord<double> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    H2MolQMC<double> qmc(1.0, 0.0, 1.0, R1, R2, 1.0);
+    qmc.set_verbose(false);
+    int nthread_max = std::max(1u, std::thread::hardware_concurrency());
+    fmt::print("Multi-walker VMC of H2, {} walkers\n", nwalker);
+    fmt::print("{:>20s}\t{:>12s}\n", "Threads", "Steps/sec");
+    for(int nthread=1; nthread<=nthread_max; nthread*=2) {
+        auto start = std::chrono::steady_clock::now();
+        qmc.sample_walkers(nwalker, maxstep, nthread);
+        auto stop = std::chrono::steady_clock::now();
+        auto sec = std::chrono::duration<double>(stop - start).count();
+        fmt::print("{:>20d}\t{:>12.4g}\n", nthread, nwalker*static_cast<double>(maxstep)/sec);
+    }
+}
+
+// Steps/sec of one walker stepped alone vs a block of walkers in lockstep
+void bench_batch(int nwalker, int maxstep) {
+    PCoord<double> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    auto rate = [&](std::function<void()> func) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto stop = std::chrono::steady_clock::now();
+        return nwalker*static_cast<double>(maxstep)/std::chrono::duration<double>(stop - start).count();
+    };
+    NaiveQMC<double> atom(0.0, 1.0, 1.0);
+    auto atom_scalar = rate([&]() { atom.sample(nwalker*maxstep); });
+    auto atom_batch = rate([&]() { atom.sample_batch(nwalker, maxstep); });
+    H2MolQMC<double, JastrowType::SIMPLE_JASTROW> mol(JastrowParam<double>(1.0), 0.0, 1.0, R1, R2, 1.0);
+    mol.set_verbose(false);
+    auto mol_scalar = rate([&]() { mol.sample(nwalker*maxstep); });
+    auto mol_batch = rate([&]() { mol.sample_walkers(nwalker, maxstep, 1); });
+    fmt::print("Scalar vs batched sampling, {} walkers, steps/sec on one thread\n", nwalker);
+    fmt::print("{:>20s}\t{:>12s}\t{:>12s}\n", "Sampler", "Scalar", "Batched");
+    fmt::print("{:>20s}\t{:>12.4g}\t{:>12.4g}\n", "NaiveQMC", atom_scalar, atom_batch);
+    fmt::print("{:>20s}\t{:>12.4g}\t{:>12.4g}\n", "H2MolQMC", mol_scalar, mol_batch);
+}
+
+// Time (us) per move of one electron, table method vs every determinant from scratch
+void bench_multidet(int nelec, int norb, int nmove) {
+    std::vector<WaveFn<double>*> orbitals;
+    for(int i=0; i<norb; i++) {
+        orbitals.push_back(new MOWaveFn<double>(0.0, 0.5 + 0.05*i, 2.0*PCoord<double>::Random(),
+                                                2.0*PCoord<double>::Random()));
+    }
+    // reference, then the singles and doubles into the virtual orbitals
+    std::vector<std::vector<int>> occs;
+    std::vector<int> ref(nelec);
+    for(int i=0; i<nelec; i++) ref[i] = i;
+    occs.push_back(ref);
+    for(int h=0; h<nelec; h++) {
+        for(int p=nelec; p<norb; p++) {
+            occs.push_back(ref);
+            occs.back()[h] = p;
+        }
+    }
+    for(int h1=0; h1<nelec; h1++) for(int h2=h1+1; h2<nelec; h2++) {
+        for(int p1=nelec; p1<norb; p1++) for(int p2=p1+1; p2<norb; p2++) {
+            occs.push_back(ref);
+            occs.back()[h1] = p1;
+            occs.back()[h2] = p2;
+        }
+    }
+    std::vector<PCoord<double>> coords(2*nelec);
+    for(auto& r: coords) r = PCoord<double>::Random();
+
+    fmt::print("Multi-determinant ratio, {} electrons, {} orbitals, us per move\n", 2*nelec, norb);
+    fmt::print("{:>20s}\t{:>12s}\t{:>12s}\t{:>12s}\n", "Determinants", "Unique up", "Table", "Naive");
+    for(int ndet: {10, 100, 1000, 10000}) {
+        int nunique = std::min(static_cast<int>(std::ceil(std::sqrt(ndet))), static_cast<int>(occs.size()));
+        std::vector<CIDeterminant<double>> dets;
+        for(int I=0; I<ndet; I++) {
+            dets.push_back({1.0/(1 + I), occs[I % nunique], occs[(I/nunique) % nunique]});
+        }
+        MultiSlaterDet<double> wfn(orbitals, nelec, nelec, dets);
+        wfn.evaluate(coords);
+        std::vector<PCoord<double>> moves(nmove);
+        for(auto& r: moves) r = PCoord<double>::Random();
+        double sink = 0.0;
+        auto t_table = timeit([&](int i) {
+            sink += wfn.ratio(i % (2*nelec), moves[i]);
+            wfn.accept();
+        }, nmove, 1);
+        // every determinant of the expansion from scratch after the move
+        Eigen::MatrixXd phi(2*nelec, norb), up(nelec, nelec), dn(nelec, nelec);
+        for(int i=0; i<2*nelec; i++) {
+            for(int j=0; j<norb; j++) phi(i, j) = orbitals[j]->value(coords[i]);
+        }
+        auto nnaive = std::max(1, nmove*10/ndet);
+        auto t_naive = timeit([&](int i) {
+            for(int j=0; j<norb; j++) phi(i % (2*nelec), j) = orbitals[j]->value(moves[i]);
+            double val = 0.0;
+            for(auto& det: dets) {
+                for(int a=0; a<nelec; a++) {
+                    up.col(a) = phi.col(det.up[a]).head(nelec);
+                    dn.col(a) = phi.col(det.dn[a]).tail(nelec);
+                }
+                val += det.coef*up.determinant()*dn.determinant();
+            }
+            sink += val;
+        }, nnaive, 1);
+        fmt::print("{:>20d}\t{:>12d}\t{:>12.3f}\t{:>12.3f}\n", ndet, wfn.unique(0), t_table*1e-3, t_naive*1e-3);
+        if(sink == 0.0) fmt::print("\n");
+    }
+    for(auto o: orbitals) delete o;
+}
+
+// Electron moves/sec of the HEG vs the number of electrons
+void bench_heg(double rs, double seconds) {
+    fmt::print("HEG at rs = {}, Ewald + plane-wave determinants\n", rs);
+    fmt::print("{:>20s}\t{:>12s}\t{:>12s}\t{:>12s}\n", "Electrons", "k-vectors", "Sweeps/sec", "Moves/sec");
+    for(int nshell=2; nshell<=8; nshell++) {
+        HEGQMC<double> qmc(nshell, rs, 0.5);
+        qmc.set_verbose(false);
+        HEG<double> heg(nshell, rs);
+        // a short run to size the timed one
+        auto start = std::chrono::steady_clock::now();
+        qmc.sample(2);
+        auto stop = std::chrono::steady_clock::now();
+        int nstep = std::max(2, static_cast<int>(seconds/std::chrono::duration<double>(stop - start).count()*2));
+        start = std::chrono::steady_clock::now();
+        qmc.sample(nstep);
+        stop = std::chrono::steady_clock::now();
+        auto rate = nstep/std::chrono::duration<double>(stop - start).count();
+        fmt::print("{:>20d}\t{:>12d}\t{:>12.4g}\t{:>12.4g}\n", heg.electrons(), heg.kvectors(), rate,
+                   rate*heg.electrons());
+    }
+}
+
+// Efficiency 1/(err^2 t) of the force along the bond, without and with the
+// average over the symmetry images
+void bench_symmetry(int maxstep) {
+    PCoord<double> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    fmt::print("Force on the nuclei of H2, {} steps\n", maxstep);
+    fmt::print("{:>20s}\t{:>12s}\t{:>12s}\t{:>12s}\t{:>12s}\n", "Images", "Force", "Force Err", "Seconds", "Efficiency");
+    double efficiency[2];
+    for(int symmetric=0; symmetric<2; symmetric++) {
+        H2MolQMC<double, JastrowType::SIMPLE_JASTROW> qmc(JastrowParam<double>(1.0), 0.0, 1.0, R1, R2, 1.0);
+        qmc.set_verbose(false);
+        qmc.seed(5);
+        qmc.set_symmetry(symmetric);
+        auto start = std::chrono::steady_clock::now();
+        auto ret = qmc.sample_force(maxstep);
+        auto stop = std::chrono::steady_clock::now();
+        auto sec = std::chrono::duration<double>(stop - start).count();
+        efficiency[symmetric] = 1/(ret.error1(0)*ret.error1(0)*sec);
+        fmt::print("{:>20d}\t{:>12.6f}\t{:>12.6f}\t{:>12.4f}\t{:>12.4g}\n", symmetric ? H2Symmetry<double>::size() : 1,
+                   ret.force1(0), ret.error1(0), sec, efficiency[symmetric]);
+    }
+    fmt::print("{:>20s}\t{:>12.2f}\n", "Gain", efficiency[1]/efficiency[0]);
+}
+
+// Energy and its standard deviation with one Jastrow factor on the orbitals
+// c = 0, alpha = 1.2, from the same seed
+template<JastrowType Jastrow>
+std::pair<double, double> jastrow_std(const JastrowParam<double>& param, int maxstep) {
+    PCoord<double> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    H2MolQMC<double, Jastrow> qmc(param, 0.0, 1.2, R1, R2, 1.0);
+    qmc.set_verbose(false);
+    qmc.seed(5);
+    return qmc.sample(maxstep);
+}
+
+// The standard deviation of the local energy sets the steps for an error bar,
+// compare the Jastrow factors at fixed parameters
+void bench_jastrow(int maxstep) {
+    fmt::print("Local energy of H2 by Jastrow factor, c = 0, alpha = 1.2, {} steps\n", maxstep);
+    fmt::print("{:>20s}\t{:>12s}\t{:>12s}\n", "Jastrow", "Energy", "Energy Std");
+    auto row = [](const char* name, const std::pair<double, double>& ret) {
+        fmt::print("{:>20s}\t{:>12.6f}\t{:>12.6f}\n", name, ret.first, ret.second);
+    };
+    row("none", jastrow_std<JastrowType::PADE_JASTROW>(JastrowParam<double>(1.0, 0.0, 1.0), maxstep));
+    row("pade a=1/4 b=1", jastrow_std<JastrowType::PADE_JASTROW>(JastrowParam<double>(1.0, 0.25, 1.0), maxstep));
+    row("simple F=1", jastrow_std<JastrowType::SIMPLE_JASTROW>(JastrowParam<double>(1.0), maxstep));
+    row("simple F=2", jastrow_std<JastrowType::SIMPLE_JASTROW>(JastrowParam<double>(2.0), maxstep));
+    row("en-pade", jastrow_std<JastrowType::EN_PADE_JASTROW>(JastrowParam<double>(), maxstep));
+}
+
+// Time per orbital value, gradient and laplacian of an even-tempered s and p
+// basis on H2, without and with the screening of the far primitives
+void bench_basis(int npoint) {
+    fmt::print("Basis-set orbital, even-tempered s and p exponents 0.05*2^k on two atoms\n");
+    fmt::print("{:>20s}\t{:>12s}\t{:>12s}\t{:>12s}\t{:>12s}\n", "Shells per atom", "Functions", "Full (ns)",
+               "Screened (ns)", "Speedup");
+    std::vector<PCoord<double>> points(npoint);
+    for(auto& p: points) p = 2.0*PCoord<double>::Random();
+    for(int nshell=4; nshell<=16; nshell*=2) {
+        std::ostringstream os;
+        os << "[Atoms] AU\nH 1 1 0 0 0.7\nH 2 1 0 0 -0.7\n[GTO]\n";
+        for(int atom=1; atom<=2; atom++) {
+            os << atom << " 0\n";
+            for(int k=0; k<nshell; k++) {
+                os << " s 1 1.0\n " << 0.05*std::pow(2.0, k) << " 1.0\n";
+                os << " p 1 1.0\n " << 0.05*std::pow(2.0, k) << " 1.0\n";
+            }
+            os << "\n";
+        }
+        os << "[MO]\nOccup= 2\n";
+        for(int j=0; j<8*nshell; j++) os << j + 1 << " " << 1.0/(j + 1) << "\n";
+        std::istringstream is(os.str());
+        auto file = MoldenFile<double>::read(is);
+        BasisOrbital<double> full(file, 0, file.atoms, std::numeric_limits<double>::infinity());
+        BasisOrbital<double> screened(file, 0, file.atoms);
+        double val, lap;
+        PCoord<double> grad;
+        double sum = 0;
+        auto t1 = timeit([&](int i) { full.evaluate(points[i], val, grad, lap); sum += lap; }, npoint);
+        auto t2 = timeit([&](int i) { screened.evaluate(points[i], val, grad, lap); sum += lap; }, npoint);
+        fmt::print("{:>20d}\t{:>12d}\t{:>12.2f}\t{:>12.2f}\t{:>12.2f}\n", nshell, file.functions.size(), t1, t2,
+                   t1/t2);
+        // keep the evaluations from being optimized out
+        volatile double sink = sum;
+        (void)sink;
+    }
+}
+
+// Cost of publishing the progress in the hot loop, steps/sec of the H2 VMC
+// without and with a Telemetry read by a reporter thread
+void bench_telemetry(int maxstep) {
+    PCoord<double> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    fmt::print("Telemetry overhead, H2 VMC of {} steps\n", maxstep);
+    fmt::print("{:>20s}\t{:>12s}\t{:>12s}\n", "Telemetry", "Steps/sec", "Overhead");
+    double rate[2];
+    auto path = fmt::format("/tmp/bench_telemetry_{}.prom", getpid());
+    for(int on=0; on<2; on++) {
+        Telemetry telemetry("benchmark");
+        if(on) telemetry.serve(path, "", 0.01);
+        H2MolQMC<double, JastrowType::SIMPLE_JASTROW> qmc(JastrowParam<double>(1.0), 0.0, 1.0, R1, R2, 1.0);
+        qmc.set_verbose(false);
+        qmc.seed(5);
+        if(on) qmc.set_telemetry(&telemetry);
+        auto start = std::chrono::steady_clock::now();
+        qmc.sample(maxstep);
+        auto stop = std::chrono::steady_clock::now();
+        rate[on] = maxstep/std::chrono::duration<double>(stop - start).count();
+        fmt::print("{:>20s}\t{:>12.4g}\t{:>11.2f}%\n", on ? "on" : "off", rate[on], 100*(rate[0]/rate[on] - 1));
+    }
+    std::remove(path.c_str());
+}
+
+int main() {
+    bench_autodiff(100000);
+    bench_batch(256, 2000);
+    bench_walkers(512, 2000);
+    bench_multidet(4, 16, 2000);
+    bench_heg(2.0, 0.5);
+    bench_symmetry(200000);
+    bench_jastrow(200000);
+    bench_basis(10000);
+    bench_telemetry(2000000);
+    return 0;
+}
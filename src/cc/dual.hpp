@@ -0,0 +1,173 @@
+#pragma once
+#include <cmath>
+#include <Eigen/Dense>
+
+// Forward-mode dual number carrying the value, the gradient and the laplacian
+// of a scalar field w.r.t. the coordinates of N particles.
+// Each operation propagates the derivatives with
+// $$\nabla_i (uv) = u \nabla_i v + v \nabla_i u$$
+// $$\nabla_i^2 (uv) = u \nabla_i^2 v + v \nabla_i^2 u + 2 \nabla_i u \cdot \nabla_i v$$
+// $$\nabla_i^2 f(u) = f'(u) \nabla_i^2 u + f''(u) |\nabla_i u|^2$$
+// N=0 gives a plain value without any derivative bookkeeping.
+template<typename T, int N=1>
+struct Dual {
+    typedef T Scalar;
+    typedef Eigen::Matrix<T, N, 3> Grad;
+    typedef Eigen::Matrix<T, N, 1> Lap;
+
+    T val;
+    Grad grad;
+    Lap lap;
+
+    Dual(): val(0), grad(Grad::Zero()), lap(Lap::Zero()) {}
+    Dual(T val): val(val), grad(Grad::Zero()), lap(Lap::Zero()) {}
+    Dual(T val, const Grad& grad, const Lap& lap): val(val), grad(grad), lap(lap) {}
+
+    // f(u) given f, f' and f'' evaluated at u
+    EIGEN_ALWAYS_INLINE Dual chain(T f, T df, T d2f) const {
+        return Dual(f, df*grad, df*lap + d2f*grad.rowwise().squaredNorm());
+    }
+};
+
+// Three cartesian components of a particle coordinate
+template<typename T, int N=1>
+struct DualCoord {
+    Dual<T, N> x, y, z;
+};
+
+// Coordinate of the i-th particle, seeded as an independent variable
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE DualCoord<T, N> variable(const Eigen::Matrix<T, 1, 3>& r, int i) {
+    DualCoord<T, N> ret {r(0), r(1), r(2)};
+    ret.x.grad(i, 0) = 1;
+    ret.y.grad(i, 1) = 1;
+    ret.z.grad(i, 2) = 1;
+    return ret;
+}
+
+// Coordinate that does not depend on any particle, e.g. a nucleus
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE DualCoord<T, N> constant(const Eigen::Matrix<T, 1, 3>& r) {
+    return DualCoord<T, N> {r(0), r(1), r(2)};
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator-(const Dual<T, N>& u) {
+    return Dual<T, N>(-u.val, -u.grad, -u.lap);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator+(const Dual<T, N>& u, const Dual<T, N>& v) {
+    return Dual<T, N>(u.val+v.val, u.grad+v.grad, u.lap+v.lap);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator+(const Dual<T, N>& u, typename Dual<T, N>::Scalar a) {
+    return Dual<T, N>(u.val+a, u.grad, u.lap);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator+(typename Dual<T, N>::Scalar a, const Dual<T, N>& u) {
+    return u + a;
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator-(const Dual<T, N>& u, const Dual<T, N>& v) {
+    return Dual<T, N>(u.val-v.val, u.grad-v.grad, u.lap-v.lap);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator-(const Dual<T, N>& u, typename Dual<T, N>::Scalar a) {
+    return Dual<T, N>(u.val-a, u.grad, u.lap);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator-(typename Dual<T, N>::Scalar a, const Dual<T, N>& u) {
+    return Dual<T, N>(a-u.val, -u.grad, -u.lap);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator*(const Dual<T, N>& u, const Dual<T, N>& v) {
+    return Dual<T, N>(u.val*v.val, u.val*v.grad + v.val*u.grad,
+        u.val*v.lap + v.val*u.lap + 2*(u.grad.array()*v.grad.array()).rowwise().sum().matrix());
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator*(const Dual<T, N>& u, typename Dual<T, N>::Scalar a) {
+    return Dual<T, N>(a*u.val, a*u.grad, a*u.lap);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator*(typename Dual<T, N>::Scalar a, const Dual<T, N>& u) {
+    return u*a;
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator/(const Dual<T, N>& u, typename Dual<T, N>::Scalar a) {
+    return u*(1/a);
+}
+
+// a/u, with (1/u)' = -1/u^2 and (1/u)'' = 2/u^3
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator/(typename Dual<T, N>::Scalar a, const Dual<T, N>& u) {
+    auto inv = 1/u.val;
+    return u.chain(a*inv, -a*inv*inv, 2*a*inv*inv*inv);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> operator/(const Dual<T, N>& u, const Dual<T, N>& v) {
+    return u*(1/v);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> exp(const Dual<T, N>& u) {
+    auto e = std::exp(u.val);
+    return u.chain(e, e, e);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> log(const Dual<T, N>& u) {
+    auto inv = 1/u.val;
+    return u.chain(std::log(u.val), inv, -inv*inv);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> sqrt(const Dual<T, N>& u) {
+    auto s = std::sqrt(u.val);
+    return u.chain(s, 0.5/s, -0.25/(s*u.val));
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> pow(const Dual<T, N>& u, int n) {
+    if(n == 0) return Dual<T, N>(1);
+    auto p = std::pow(u.val, n-2);
+    return u.chain(p*u.val*u.val, n*p*u.val, n*(n-1)*p);
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE DualCoord<T, N> operator-(const DualCoord<T, N>& a, const DualCoord<T, N>& b) {
+    return DualCoord<T, N> {a.x-b.x, a.y-b.y, a.z-b.z};
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE DualCoord<T, N> operator-(const DualCoord<T, N>& a, const Eigen::Matrix<T, 1, 3>& b) {
+    return DualCoord<T, N> {a.x-b(0), a.y-b(1), a.z-b(2)};
+}
+
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> squaredNorm(const DualCoord<T, N>& a) {
+    return a.x*a.x + a.y*a.y + a.z*a.z;
+}
+
+// $$\nabla_i |a| = \sum_c a_c \nabla_i a_c / |a|$$
+// $$\nabla_i^2 |a| = (\sum_c a_c \nabla_i^2 a_c + |\nabla_i a_c|^2 - |\nabla_i |a||^2)/|a|$$
+template<typename T, int N>
+EIGEN_ALWAYS_INLINE Dual<T, N> norm(const DualCoord<T, N>& a) {
+    T r = std::sqrt(a.x.val*a.x.val + a.y.val*a.y.val + a.z.val*a.z.val);
+    T inv = 1/r;
+    typename Dual<T, N>::Grad grad = (a.x.val*a.x.grad + a.y.val*a.y.grad + a.z.val*a.z.grad)*inv;
+    typename Dual<T, N>::Lap lap = (a.x.val*a.x.lap + a.y.val*a.y.lap + a.z.val*a.z.lap +
+        a.x.grad.rowwise().squaredNorm() + a.y.grad.rowwise().squaredNorm() +
+        a.z.grad.rowwise().squaredNorm() - grad.rowwise().squaredNorm())*inv;
+    return Dual<T, N>(r, grad, lap);
+}
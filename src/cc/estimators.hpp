@@ -0,0 +1,238 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+#include <ostream>
+#include <string>
+#include <fmt/core.h>
+#include <Eigen/Dense>
+#include "walker.hpp"
+
+// n running sums in their own cache-line aligned block, padded to whole
+// lines, so that the copies owned by different threads never share a line
+template<typename T>
+class Tally {
+public:
+    Tally(size_t n): n(n), arena(n*sizeof(T)) {
+        data = arena.allocate<T>(n);
+        std::fill(data, data + n, static_cast<T>(0));
+    }
+
+    inline T& operator[](size_t i) {
+        return data[i];
+    }
+
+    inline T operator[](size_t i) const {
+        return data[i];
+    }
+
+    size_t size() const {
+        return n;
+    }
+
+    void merge(const Tally& other) {
+        for(size_t i=0; i<n; i++) data[i] += other.data[i];
+    }
+
+private:
+    size_t n;
+    Arena arena;
+    T* data;
+};
+
+// Observable accumulated on the fly by the samplers. Every thread works on
+// its own clone(), which are merged into the original at the end of the run
+template<typename Mol>
+class Estimator {
+public:
+    typedef typename Mol::Scalar T;
+    typedef typename Mol::Coord Coord;
+    typedef typename Mol::Components Components;
+
+    virtual ~Estimator() {}
+
+    // add the configuration (r1, r2) of the electrons, e is its local energy
+    // when the sampler has already evaluated it, else nullptr
+    virtual void accumulate(Mol& mol, const Coord& r1, const Coord& r2, const Components* e=nullptr)=0;
+
+    // add the average over the symmetry images of (r1, r2) (see H2Symmetry),
+    // observables invariant under them only need accumulate()
+    virtual void accumulate_images(Mol& mol, const Coord& r1, const Coord& r2, const Components* e=nullptr) {
+        accumulate(mol, r1, r2, e);
+    }
+
+    // an empty estimator with the same settings, owned by the caller
+    virtual Estimator* clone() const=0;
+
+    // add the samples of a clone
+    virtual void merge(const Estimator& other)=0;
+
+    virtual void write(std::ostream& os) const=0;
+};
+
+// Electron density along the bond axis, integrated over the perpendicular
+// plane, $$\rho(z) = \langle \sum_i \delta(z - (\mathbf{r_i}-\mathbf{R_c})\cdot\hat{\mathbf{e}}) \rangle$$
+// with the bond center R_c and the unit bond vector e
+template<typename Mol>
+class BondDensity: public Estimator<Mol> {
+public:
+    typedef typename Estimator<Mol>::T T;
+    typedef typename Estimator<Mol>::Coord Coord;
+    typedef typename Estimator<Mol>::Components Components;
+
+    BondDensity(int nbin=100, T extent=4.0):
+        nbin(nbin), extent(extent), width(2*extent/nbin), tally(nbin + 1) {}
+
+    void accumulate(Mol& mol, const Coord& r1, const Coord& r2, const Components* =nullptr) {
+        auto nuclei = mol.geometry();
+        Coord center = 0.5*(nuclei.first + nuclei.second);
+        Coord axis = (nuclei.first - nuclei.second).normalized();
+        add((r1 - center).dot(axis));
+        add((r2 - center).dot(axis));
+        tally[nbin] += 1;
+    }
+
+    // half of the images flip the bond axis, z -> -z
+    void accumulate_images(Mol& mol, const Coord& r1, const Coord& r2, const Components* =nullptr) {
+        auto nuclei = mol.geometry();
+        Coord center = 0.5*(nuclei.first + nuclei.second);
+        Coord axis = (nuclei.first - nuclei.second).normalized();
+        for(auto z: {(r1 - center).dot(axis), (r2 - center).dot(axis)}) {
+            add(z, 0.5);
+            add(-z, 0.5);
+        }
+        tally[nbin] += 1;
+    }
+
+    BondDensity* clone() const {
+        return new BondDensity(nbin, extent);
+    }
+
+    void merge(const Estimator<Mol>& other) {
+        tally.merge(static_cast<const BondDensity&>(other).tally);
+    }
+
+    void write(std::ostream& os) const {
+        os << fmt::format("# Electron density along the bond axis, {:g} samples\n", tally[nbin]);
+        os << fmt::format("{:>20s}\t{:>20s}\n", "z", "rho");
+        for(int i=0; i<nbin; i++) {
+            os << fmt::format("{:>20.6f}\t{:>20.6f}\n", -extent + (i + 0.5)*width,
+                              tally[i]/(std::max(tally[nbin], static_cast<T>(1))*width));
+        }
+    }
+
+private:
+    int nbin;
+    T extent, width;
+    Tally<T> tally; // bins, number of samples
+
+    inline void add(T z, T weight=1) {
+        if(z < -extent || z >= extent) return;
+        tally[std::min(static_cast<int>((z + extent)/width), nbin - 1)] += weight;
+    }
+};
+
+// Distribution P(r) of the e-e distance and the pair correlation
+// $$g(r) = \frac{P(r)}{4\pi r^2}$$
+template<typename Mol>
+class PairCorrelation: public Estimator<Mol> {
+public:
+    typedef typename Estimator<Mol>::T T;
+    typedef typename Estimator<Mol>::Coord Coord;
+    typedef typename Estimator<Mol>::Components Components;
+
+    PairCorrelation(int nbin=100, T rmax=6.0):
+        nbin(nbin), rmax(rmax), width(rmax/nbin), tally(nbin + 1) {}
+
+    void accumulate(Mol&, const Coord& r1, const Coord& r2, const Components* =nullptr) {
+        auto r = (r1 - r2).norm();
+        if(r < rmax) tally[std::min(static_cast<int>(r/width), nbin - 1)] += 1;
+        tally[nbin] += 1;
+    }
+
+    PairCorrelation* clone() const {
+        return new PairCorrelation(nbin, rmax);
+    }
+
+    void merge(const Estimator<Mol>& other) {
+        tally.merge(static_cast<const PairCorrelation&>(other).tally);
+    }
+
+    void write(std::ostream& os) const {
+        os << fmt::format("# e-e pair correlation, {:g} samples\n", tally[nbin]);
+        os << fmt::format("{:>20s}\t{:>20s}\t{:>20s}\n", "r", "P(r)", "g(r)");
+        for(int i=0; i<nbin; i++) {
+            auto r = (i + 0.5)*width;
+            auto p = tally[i]/(std::max(tally[nbin], static_cast<T>(1))*width);
+            os << fmt::format("{:>20.6f}\t{:>20.6f}\t{:>20.6f}\n", r, p, p/(4*M_PI*r*r));
+        }
+    }
+
+private:
+    int nbin;
+    T rmax, width;
+    Tally<T> tally; // bins, number of samples
+};
+
+// Kinetic, e-n, e-e and n-n energies, the total energy and the virial ratio
+// $$-\langle V \rangle / \langle T \rangle$$, which is 2 for the exact
+// wave function at the equilibrium geometry
+template<typename Mol>
+class EnergyEstimator: public Estimator<Mol> {
+public:
+    typedef typename Estimator<Mol>::T T;
+    typedef typename Estimator<Mol>::Coord Coord;
+    typedef typename Estimator<Mol>::Components Components;
+
+    EnergyEstimator(): tally(2*ncomp + 1) {}
+
+    // the components of the sampler, only evaluated without them
+    void accumulate(Mol& mol, const Coord& r1, const Coord& r2, const Components* energy=nullptr) {
+        auto e = energy ? *energy : mol.energy_components(r1, r2);
+        T comp[ncomp] = {e.kinetic, e.electron_nuclear, e.electron_electron,
+                         e.nuclear_nuclear, e.total()};
+        for(int i=0; i<ncomp; i++) {
+            tally[i] += comp[i];
+            tally[ncomp + i] += comp[i]*comp[i];
+        }
+        tally[2*ncomp] += 1;
+    }
+
+    EnergyEstimator* clone() const {
+        return new EnergyEstimator();
+    }
+
+    void merge(const Estimator<Mol>& other) {
+        tally.merge(static_cast<const EnergyEstimator&>(other).tally);
+    }
+
+    // mean of component i, in the order kinetic, e-n, e-e, n-n, total
+    T mean(int i) const {
+        return tally[i]/std::max(tally[2*ncomp], static_cast<T>(1));
+    }
+
+    T stddev(int i) const {
+        auto m = mean(i);
+        return std::sqrt(std::max(tally[ncomp + i]/std::max(tally[2*ncomp], static_cast<T>(1)) - m*m,
+                                  static_cast<T>(0)));
+    }
+
+    T virial_ratio() const {
+        return -(mean(1) + mean(2) + mean(3))/mean(0);
+    }
+
+    void write(std::ostream& os) const {
+        const std::string names[ncomp] = {"Kinetic", "Electron-nuclear", "Electron-electron",
+                                          "Nuclear-nuclear", "Total"};
+        os << fmt::format("# Energy components, {:g} samples\n", tally[2*ncomp]);
+        os << fmt::format("{:>20s}\t{:>20s}\t{:>20s}\n", "Component", "mean", "std");
+        for(int i=0; i<ncomp; i++) {
+            os << fmt::format("{:>20s}\t{:>20.6f}\t{:>20.6f}\n", names[i], mean(i), stddev(i));
+        }
+        os << fmt::format("{:>20s}\t{:>20.6f}\n", "Virial -V/T", virial_ratio());
+    }
+
+private:
+    static const int ncomp = 5;
+    Tally<T> tally; // sums, sums of squares, number of samples
+};
@@ -0,0 +1,321 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <fmt/core.h>
+#include <Eigen/Dense>
+#include "hydrogen.hpp"
+
+// Homogeneous electron gas: N electrons (closed shells, half up, half down)
+// in a periodic cube of side L with a neutralizing background,
+// $$\frac{4}{3}\pi r_s^3 N = L^3$$
+// The trial wave function is the plane-wave Slater determinant of each spin,
+// with the real orbitals 1, cos(k.r), sin(k.r). The Coulomb energy is summed by
+// Ewald, the real-space part over the minimum images, the reciprocal part over
+// the cached structure factors $$S(\mathbf{k}) = \sum_j e^{i\mathbf{k}\cdot\mathbf{r_j}}$$,
+// which are updated by every accepted move.
+template<typename T>
+class HEG {
+public:
+    typedef std::complex<T> Complex;
+    typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Matrix<T, Eigen::Dynamic, 1> Vector;
+
+    // nshell closed shells of k-vectors per spin, Ewald accuracy tol
+    HEG(int nshell, T rs, T tol=1e-6): rs(rs) {
+        // orbitals, the shells of integer vectors by |n|^2
+        std::vector<Eigen::Vector3i> half;
+        int nmax = 0;
+        int nfound = 0;
+        for(int n2=1; nfound<nshell-1; n2++) {
+            bool found = false;
+            int m = static_cast<int>(std::sqrt(n2)) + 1;
+            for(int x=-m; x<=m; x++) for(int y=-m; y<=m; y++) for(int z=-m; z<=m; z++) {
+                if(x*x + y*y + z*z != n2 || !positive(x, y, z)) continue;
+                half.emplace_back(x, y, z);
+                nmax = std::max({nmax, std::abs(x), std::abs(y), std::abs(z)});
+                found = true;
+            }
+            if(found) nfound++;
+        }
+        norb = 1 + 2*half.size();
+        nelec = 2*norb;
+        L = std::cbrt(4*M_PI*nelec/3)*rs;
+        volume = L*L*L;
+        g = 2*M_PI/L;
+        orbital_k = half;
+        kinetic_energy = 0.0;
+        for(auto& n: half) kinetic_energy += 2*0.5*g*g*n.squaredNorm(); // cos and sin
+        kinetic_energy *= 2; // two spins
+
+        // Ewald splitting, erfc(kappa L/2) = exp(-kc^2/4kappa^2) = tol
+        auto x = std::sqrt(-std::log(tol));
+        kappa = 2*x/L;
+        rc = L/2;
+        auto kc = 2*kappa*x;
+        kmax = std::max(static_cast<int>(kc/g), nmax);
+        for(int nx=0; nx<=kmax; nx++) for(int ny=-kmax; ny<=kmax; ny++) for(int nz=-kmax; nz<=kmax; nz++) {
+            if(!positive(nx, ny, nz)) continue;
+            auto k2 = g*g*(nx*nx + ny*ny + nz*nz);
+            if(k2 > kc*kc) continue;
+            kvec.emplace_back(nx, ny, nz);
+            // both k and -k
+            kweight.push_back(2*2*M_PI/volume*std::exp(-k2/(4*kappa*kappa))/k2);
+        }
+        sk.resize(kvec.size());
+        e_self = -kappa*nelec/std::sqrt(M_PI);
+        e_background = -M_PI*nelec*nelec/(2*volume*kappa*kappa);
+        phase_new.resize(3*(2*kmax + 1));
+        phase_old.resize(3*(2*kmax + 1));
+    }
+
+    int electrons() const {
+        return nelec;
+    }
+
+    T box() const {
+        return L;
+    }
+
+    T ewald_kappa() const {
+        return kappa;
+    }
+
+    size_t kvectors() const {
+        return kvec.size();
+    }
+
+    const std::vector<PCoord<T>>& positions() const {
+        return coords;
+    }
+
+    // Place the electrons (up first) and build the determinants and the
+    // structure factors from scratch
+    void set_positions(const std::vector<PCoord<T>>& r) {
+        if(static_cast<int>(r.size()) != nelec) throw std::runtime_error("Invalid number of electrons");
+        coords = r;
+        for(auto& c: coords) wrap(c);
+        Vector phi(norb);
+        for(int s=0; s<2; s++) {
+            slater[s].resize(norb, norb);
+            for(int i=0; i<norb; i++) {
+                phases(coords[s*norb + i], phase_new);
+                orbitals(phase_new, phi);
+                slater[s].row(i) = phi.transpose();
+            }
+            inverse[s] = slater[s].inverse();
+        }
+        std::fill(sk.begin(), sk.end(), Complex(0, 0));
+        for(auto& c: coords) {
+            phases(c, phase_new);
+            for(size_t k=0; k<kvec.size(); k++) sk[k] += plane_wave(phase_new, k);
+        }
+        e_recip = 0.0;
+        for(size_t k=0; k<kvec.size(); k++) e_recip += kweight[k]*std::norm(sk[k]);
+        e_real = 0.0;
+        for(int i=0; i<nelec; i++) {
+            for(int j=i+1; j<nelec; j++) e_real += pair(coords[i], coords[j]);
+        }
+    }
+
+    // ln|psi| of the current configuration from scratch
+    T log_value() const {
+        T ret = 0.0;
+        for(int s=0; s<2; s++) {
+            Eigen::PartialPivLU<Matrix> lu(slater[s]);
+            ret += lu.matrixLU().diagonal().array().abs().log().sum();
+        }
+        return ret;
+    }
+
+    // psi(r_e -> r_new)/psi, kept until accept() or the next ratio()
+    T ratio(int e, const PCoord<T>& r_new) {
+        moved = e;
+        r_moved = r_new;
+        wrap(r_moved);
+        phases(r_moved, phase_new);
+        phi_new.resize(norb);
+        orbitals(phase_new, phi_new);
+        auto s = e/norb, i = e % norb;
+        return phi_new.dot(inverse[s].col(i));
+    }
+
+    void accept() {
+        auto s = moved/norb, i = moved % norb;
+        // Sherman-Morrison for the new row of the determinant
+        Vector da = phi_new - slater[s].row(i).transpose();
+        Vector col = inverse[s].col(i)/(1 + da.dot(inverse[s].col(i)));
+        Eigen::Matrix<T, 1, Eigen::Dynamic> dainv = da.transpose()*inverse[s];
+        inverse[s] -= col*dainv;
+        slater[s].row(i) = phi_new.transpose();
+
+        // real space, only the pairs of the moved electron
+        for(int j=0; j<nelec; j++) {
+            if(j == moved) continue;
+            e_real += pair(r_moved, coords[j]) - pair(coords[moved], coords[j]);
+        }
+        // reciprocal space, S(k) += exp(ik.r_new) - exp(ik.r_old)
+        phases(coords[moved], phase_old);
+        e_recip = 0.0;
+        for(size_t k=0; k<kvec.size(); k++) {
+            sk[k] += plane_wave(phase_new, k) - plane_wave(phase_old, k);
+            e_recip += kweight[k]*std::norm(sk[k]);
+        }
+        coords[moved] = r_moved;
+    }
+
+    // the kinetic energy of the plane waves is the same for all configurations
+    T kinetic() const {
+        return kinetic_energy;
+    }
+
+    T potential() const {
+        return e_real + e_recip + e_self + e_background;
+    }
+
+    T energy() const {
+        return kinetic() + potential();
+    }
+
+private:
+    T rs, L, volume, g;
+    int norb, nelec, kmax;
+    std::vector<Eigen::Vector3i> orbital_k, kvec;
+    std::vector<T> kweight;
+    std::vector<Complex> sk;
+    T kappa, rc;
+    T kinetic_energy, e_real = 0.0, e_recip = 0.0, e_self, e_background;
+    std::vector<PCoord<T>> coords;
+    Matrix slater[2], inverse[2];
+
+    // the pending move
+    int moved = 0;
+    PCoord<T> r_moved;
+    Vector phi_new;
+    std::vector<Complex> phase_new, phase_old;
+
+    // one of k, -k
+    static bool positive(int x, int y, int z) {
+        return x > 0 || (x == 0 && (y > 0 || (y == 0 && z > 0)));
+    }
+
+    inline void wrap(PCoord<T>& r) const {
+        for(int d=0; d<3; d++) r(d) -= L*std::floor(r(d)/L);
+    }
+
+    // Ewald real space term of a pair over the minimum image
+    inline T pair(const PCoord<T>& a, const PCoord<T>& b) const {
+        PCoord<T> d = a - b;
+        for(int i=0; i<3; i++) d(i) -= L*std::round(d(i)/L);
+        auto r = d.norm();
+        return r < rc ? std::erfc(kappa*r)/r : 0.0;
+    }
+
+    // exp(i g n r_d) for n = -kmax..kmax by recurrence, one sincos per dimension
+    void phases(const PCoord<T>& r, std::vector<Complex>& out) const {
+        auto w = 2*kmax + 1;
+        for(int d=0; d<3; d++) {
+            Complex* p = out.data() + d*w + kmax;
+            Complex e1 = std::polar(static_cast<T>(1), g*r(d));
+            p[0] = 1;
+            for(int n=1; n<=kmax; n++) {
+                p[n] = p[n-1]*e1;
+                p[-n] = std::conj(p[n]);
+            }
+        }
+    }
+
+    inline Complex plane_wave(const std::vector<Complex>& ph, size_t k) const {
+        auto w = 2*kmax + 1;
+        auto& n = kvec[k];
+        return ph[kmax + n(0)]*ph[w + kmax + n(1)]*ph[2*w + kmax + n(2)];
+    }
+
+    void orbitals(const std::vector<Complex>& ph, Vector& out) const {
+        auto w = 2*kmax + 1;
+        out(0) = 1;
+        for(size_t j=0; j<orbital_k.size(); j++) {
+            auto& n = orbital_k[j];
+            auto e = ph[kmax + n(0)]*ph[w + kmax + n(1)]*ph[2*w + kmax + n(2)];
+            out(1 + 2*j) = e.real();
+            out(2 + 2*j) = e.imag();
+        }
+    }
+};
+
+// Metropolis sampling of the HEG, one step moves every electron once
+template<typename T>
+class HEGQMC {
+public:
+    HEGQMC(int nshell, T rs, T dr, T tol=1e-6): heg(nshell, rs, tol), dr(dr) {}
+
+    void seed(unsigned s) {
+        rgen.seed(s);
+    }
+
+    void set_verbose(bool v) {
+        verbose = v;
+    }
+
+    T accept_ratio() const {
+        return accept_rate;
+    }
+
+    int electrons() const {
+        return heg.electrons();
+    }
+
+    // energy per electron and its std, the determinants are rebuilt every
+    // refresh steps to drop the round-off of the updates
+    std::pair<T, T> sample(int maxstep=1000, int refresh=100) {
+        std::uniform_real_distribution<T> udist(0, heg.box());
+        std::uniform_real_distribution<T> rnum(0, 1);
+        std::vector<PCoord<T>> coords(heg.electrons());
+        for(auto& r: coords) r << udist(rgen), udist(rgen), udist(rgen);
+        heg.set_positions(coords);
+        T energy_tot = 0.0, energy_sq_tot = 0.0;
+        long accept = 0, count = 0;
+        T step = dr*heg.box()/std::cbrt(heg.electrons());
+        for(int i=0; i<maxstep; i++) {
+            for(int e=0; e<heg.electrons(); e++) {
+                PCoord<T> r_new = heg.positions()[e] + step*random_coord();
+                auto ratio = heg.ratio(e, r_new);
+                if(std::log(rnum(rgen)) < 2*std::log(std::abs(ratio))) {
+                    heg.accept();
+                    accept++;
+                }
+                count++;
+            }
+            if(static_cast<T>(accept)/count > 0.5) step *= scale;
+            else step /= scale;
+            if((i + 1) % refresh == 0) heg.set_positions(heg.positions());
+            auto energy = heg.energy()/heg.electrons();
+            energy_tot += energy;
+            energy_sq_tot += energy*energy;
+        }
+        accept_rate = static_cast<T>(accept)/count;
+        auto energy_avg = energy_tot/maxstep;
+        auto energy_std = std::sqrt(std::max(energy_sq_tot/maxstep - energy_avg*energy_avg, static_cast<T>(0)));
+        if(verbose) fmt::print("Accept ratio: {}\n", accept_rate);
+        return {energy_avg, energy_std};
+    }
+
+private:
+    HEG<T> heg;
+    T dr;
+    std::random_device rd;
+    std::mt19937 rgen{rd()};
+    std::uniform_real_distribution<T> rdist{-1, 1};
+    const T scale = 1.01;
+    bool verbose = true;
+    T accept_rate = 0.0;
+
+    inline PCoord<T> random_coord() {
+        PCoord<T> ret;
+        ret << rdist(rgen), rdist(rgen), rdist(rgen);
+        return ret;
+    }
+};
@@ -1,10 +1,101 @@
+#include <algorithm>
+#include <chrono>
 #include <fmt/core.h>
 #include <cxxopts.hpp>
+#include <fstream>
+#include <memory>
+#include <thread>
 #include <vector>
 #include "hydrogen.hpp"
 
 const double Hartree = 27.21138602;
 
+template<JastrowType Jastrow, AtomicWfnType AtomicWfn>
+std::pair<double, double> run_qmc(const cxxopts::ParseResult& result, const JastrowParam<double>& param,
+                                  const PCoord<double>& r1, const PCoord<double>& r2, ResultCache* cache,
+                                  std::shared_ptr<const MoldenFile<double>> basis, Telemetry* telemetry) {
+    auto c = result["c"].as<double>();
+    auto alpha = result["alpha"].as<double>();
+    auto s = result["step"].as<double>();
+    auto nstep = result["nstep"].as<int>();
+    auto orbital = result["orbital"].as<int>();
+    H2MolQMC<double, Jastrow, AtomicWfn> h2qmc(param, c, alpha, r1, r2, s, basis, orbital);
+    if(result.count("seed") || cache) h2qmc.seed(result["seed"].as<unsigned>());
+    h2qmc.set_symmetry(result["symmetry"].as<bool>());
+    h2qmc.set_telemetry(telemetry);
+    h2qmc.set_block(result["block"].as<long>());
+    if(result["optimize"].as<bool>()) {
+        fmt::print("Geometry optimization...\n");
+        auto ret = h2qmc.optimize(result["niter"].as<int>(), nstep, result["fstep"].as<double>(),
+                                  result["ftol"].as<double>());
+        PCoord<double> R1, R2;
+        std::tie(R1, R2) = h2qmc.geometry();
+        fmt::print("Final geometry: r1 = ({:.6f}, {:.6f}, {:.6f}), r2 = ({:.6f}, {:.6f}, {:.6f})\n",
+                   R1(0), R1(1), R1(2), R2(0), R2(1), R2(2));
+        return {ret.energy, ret.energy_std};
+    }
+    if(result["force"].as<bool>()) {
+        auto start = std::chrono::steady_clock::now();
+        auto ret = h2qmc.sample_force(nstep);
+        auto sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fmt::print("{:>20s}\t{:>20s}\n", "Force on r1", "Force Err");
+        for(int i=0; i<3; i++) fmt::print("{:>20.8f}\t{:>20.8f}\n", ret.force1(i), ret.error1(i));
+        // of the force along the bond, compare with and without --symmetry
+        PCoord<double> axis = (r1 - r2).normalized();
+        auto err = ret.error1.cwiseProduct(axis.cwiseAbs()).norm();
+        fmt::print("{:>20s}\t{:>20.6g}\n", "Efficiency 1/(s^2 t)", 1/(err*err*sec));
+        return {ret.energy, ret.energy_std};
+    }
+    typedef typename H2MolQMC<double, Jastrow, AtomicWfn>::Mol Mol;
+    BondDensity<Mol> density;
+    PairCorrelation<Mol> pair;
+    EnergyEstimator<Mol> components;
+    std::vector<Estimator<Mol>*> estimators;
+    auto path = result["estimators"].as<std::string>();
+    if(!path.empty()) estimators = {&density, &pair, &components};
+    auto every = result["every"].as<int>();
+
+    auto nwalker = result["walkers"].as<int>();
+    auto nthread = result["threads"].as<int>();
+    if(nthread <= 0) nthread = std::max(1u, std::thread::hardware_concurrency());
+    // a cached point has no estimators to read back, they always run
+    if(!estimators.empty()) cache = nullptr;
+    CacheKey key("hydrogen", "h2", result["seed"].as<unsigned>());
+    key.add("jastrow", result["jastrow"].as<std::string>()).add("F", param.factor).add("a", param.a)
+       .add("b", param.b).add("aen", param.a_en).add("ben", param.b_en).add("c", c).add("alpha", alpha)
+       .add("step", s).add("walkers", nwalker).add("threads", nwalker > 1 ? nthread : 1)
+       .add("block", std::max(result["block"].as<long>(), 0L));
+    for(int i=0; i<3; i++) key.add("r1", r1(i)).add("r2", r2(i));
+    if(basis) key.add("basis", fmt::format("{:x}", basis->checksum)).add("orbital", orbital);
+    std::string status;
+    auto ret = cached_run(cache, key, nwalker > 1 ? nstep/nwalker : nstep,
+        [&](long n, unsigned seed) -> std::vector<Block<double>> {
+            if(result.count("seed") || cache) h2qmc.seed(seed);
+            if(nwalker > 1) h2qmc.sample_walkers(nwalker, n, nthread, estimators, every);
+            else h2qmc.sample(n, estimators, every);
+            return h2qmc.blocks();
+        }, status);
+    fmt::print("{:>20s}\t{:>20s}\t{:>20s}\n", "Steps", "Energy Err", "Cache");
+    fmt::print("{:>20d}\t{:>20.8f}\t{:>20s}\n", ret.steps, ret.error, cache ? status : "off");
+    if(!path.empty()) {
+        std::ofstream output(path);
+        for(auto est: estimators) {
+            est->write(output);
+            output << "\n";
+        }
+    }
+    return {ret.mean, ret.std};
+}
+
+// the orbitals of the basis file if there is one, else the MO of (1+cr)e^{-alpha r}
+template<JastrowType Jastrow>
+std::pair<double, double> run_orbitals(const cxxopts::ParseResult& result, const JastrowParam<double>& param,
+                                       const PCoord<double>& r1, const PCoord<double>& r2, ResultCache* cache,
+                                       std::shared_ptr<const MoldenFile<double>> basis, Telemetry* telemetry) {
+    if(basis) return run_qmc<Jastrow, AtomicWfnType::BASIS>(result, param, r1, r2, cache, basis, telemetry);
+    return run_qmc<Jastrow, AtomicWfnType::MO>(result, param, r1, r2, cache, basis, telemetry);
+}
+
 int main(int argc, char** argv) {
     // H2MolQMC<double> h2qmc;
     // r1 << 0.40, 0.0, 0.0;
@@ -12,13 +103,42 @@ int main(int argc, char** argv) {
     // H2MolQMC<double> h2qmc(1.0, 0.5, 1.0, r1, r2, 0.1);
     cxxopts::Options options("HydrogenQMC", "Quantum Monte Carlo Program for Hydrogen Molecule");
     options.add_options()
-        ("F", "Jastrow factor parameter", cxxopts::value<double>()->default_value("1.0"))
+        ("F", "Simple Jastrow factor parameter", cxxopts::value<double>()->default_value("1.0"))
+        ("j,jastrow", "Jastrow factor: simple, pade, en-pade", cxxopts::value<std::string>()->default_value("simple"))
+        ("a", "Pade e-e Jastrow parameter a", cxxopts::value<double>()->default_value("0.5"))
+        ("b", "Pade e-e Jastrow parameter b", cxxopts::value<double>()->default_value("0.3"))
+        ("aen", "Pade e-n Jastrow parameter a", cxxopts::value<double>()->default_value("0.2"))
+        ("ben", "Pade e-n Jastrow parameter b", cxxopts::value<double>()->default_value("1.5"))
         ("c", "Trial wave function parameter c", cxxopts::value<double>()->default_value("0.0"))
         ("alpha", "Trial wave function parameter alpha", cxxopts::value<double>()->default_value("1.0"))
         ("s,step", "Monte Carlo step size", cxxopts::value<double>()->default_value("1.0"))
         ("n,nstep", "Monte Carlo step size", cxxopts::value<int>()->default_value("1000000"))
         ("r1", "First atom coordinateds", cxxopts::value<std::vector<double>>()->default_value("0.5 0.0 0.0"))
         ("r2", "Second atom coordinateds", cxxopts::value<std::vector<double>>()->default_value("-0.5 0.0 0.0"))
+        ("w,walkers", "Number of walkers", cxxopts::value<int>()->default_value("1"))
+        ("t,threads", "Number of threads for the walkers, 0 for all cores", cxxopts::value<int>()->default_value("1"))
+        ("force", "Calculate the forces on the atoms", cxxopts::value<bool>()->default_value("false"))
+        ("o,optimize", "Optimize the geometry with QMC forces", cxxopts::value<bool>()->default_value("false"))
+        ("niter", "Maximum geometry optimization steps", cxxopts::value<int>()->default_value("20"))
+        ("fstep", "Geometry optimization step per unit force", cxxopts::value<double>()->default_value("0.5"))
+        ("ftol", "Geometry optimization force tolerance", cxxopts::value<double>()->default_value("0.001"))
+        ("estimators", "Write the bond density, pair correlation and energy components to this file",
+         cxxopts::value<std::string>()->default_value(""))
+        ("every", "Steps between the samples of the estimators", cxxopts::value<int>()->default_value("10"))
+        ("basis", "Molden file of the basis set and the orbitals, replaces (1+cr)e^{-alpha r}",
+         cxxopts::value<std::string>()->default_value(""))
+        ("orbital", "Orbital of the basis file occupied by both electrons", cxxopts::value<int>()->default_value("0"))
+        ("symmetry", "Average the forces and the estimators over the symmetry images of the bond",
+         cxxopts::value<bool>()->default_value("false"))
+        ("cache", "Result cache file, known points are read back or extended", cxxopts::value<std::string>()->default_value(""))
+        ("seed", "Random seed, always fixed with --cache", cxxopts::value<unsigned>()->default_value("1"))
+        ("block", "Steps per block of the error estimate, 0 for one block and no error", cxxopts::value<long>()->default_value("1000"))
+        ("metrics", "Rewrite this file with the live progress in the Prometheus text format",
+         cxxopts::value<std::string>()->default_value(""))
+        ("metrics-socket", "Serve the live progress on this Unix-domain socket",
+         cxxopts::value<std::string>()->default_value(""))
+        ("metrics-interval", "Seconds between the rewrites of the metrics file",
+         cxxopts::value<double>()->default_value("5"))
         ("h,help", "Print usage")
     ;
     auto result = options.parse(argc, argv);
@@ -26,6 +146,10 @@ int main(int argc, char** argv) {
         fmt::print("%s\n", options.help());
         exit(0);
     }
+    if(result["every"].as<int>() < 1) {
+        fmt::print(stderr, "--every must be at least 1\n");
+        return 1;
+    }
     std::string banner =                                                
         R"(                               ____                  )" "\n" 
         R"(        ,----..              ,'  , `.   ,----..      )" "\n" 
@@ -52,14 +176,59 @@ int main(int argc, char** argv) {
     r1<<r1_opt[0],r1_opt[1],r1_opt[2];
     r2<<r2_opt[0],r2_opt[1],r2_opt[2];
     auto F = result["F"].as<double>();
-    auto c = result["c"].as<double>();
-    auto alpha = result["alpha"].as<double>();
-    auto s = result["step"].as<double>();
-    auto nstep = result["nstep"].as<int>();
-    H2MolQMC<double> h2qmc(F, c, alpha, r1, r2, s);
-    double energy, energy_std;
-    std::tie(energy, energy_std) = h2qmc.sample(nstep);
-    fmt::print("{:>20s}\t{:>20s}\n", "Energy (eV rel. 2H)", "Energy Std");
-    fmt::print("{:>20.8f}\t{:>20.8f}\n", (energy+1)*Hartree, energy_std);
+    JastrowParam<double> param(F, result["a"].as<double>(), result["b"].as<double>(),
+                               result["aen"].as<double>(), result["ben"].as<double>());
+    // a bad basis file, orbital or cache ends the run with one line
+    try {
+        // a parameter the Jastrow factor does not use would only change the cache key
+        auto jastrow = parse_jastrow(result["jastrow"].as<std::string>());
+        auto& used = jastrow_params(jastrow);
+        for(std::string key: {"F", "a", "b", "aen", "ben"}) {
+            if(result.count(key) && std::find(used.begin(), used.end(), key) == used.end()) {
+                throw std::runtime_error(fmt::format("The {} Jastrow factor has no parameter {}",
+                                                     result["jastrow"].as<std::string>(), key));
+            }
+        }
+        // the nuclei of the basis file unless given
+        std::shared_ptr<const MoldenFile<double>> basis;
+        auto basis_path = result["basis"].as<std::string>();
+        if(!basis_path.empty()) {
+            basis = std::make_shared<MoldenFile<double>>(MoldenFile<double>::load(basis_path));
+            if(basis->atoms.size() == 2) {
+                if(!result.count("r1")) r1 = basis->atoms[0];
+                if(!result.count("r2")) r2 = basis->atoms[1];
+            }
+        }
+        std::unique_ptr<ResultCache> cache;
+        auto cache_path = result["cache"].as<std::string>();
+        if(!cache_path.empty()) cache.reset(new ResultCache(cache_path));
+        // live progress for the schedulers, one slot per walker thread
+        std::unique_ptr<Telemetry> telemetry;
+        auto metrics_path = result["metrics"].as<std::string>();
+        auto metrics_socket = result["metrics-socket"].as<std::string>();
+        if(!metrics_path.empty() || !metrics_socket.empty()) {
+            auto nthread = result["threads"].as<int>();
+            if(nthread <= 0) nthread = std::max(1u, std::thread::hardware_concurrency());
+            telemetry.reset(new Telemetry("hydrogen", nthread));
+            telemetry->serve(metrics_path, metrics_socket, result["metrics-interval"].as<double>());
+        }
+        double energy = 0.0, energy_std = 0.0;
+        switch(jastrow) {
+            case JastrowType::SIMPLE_JASTROW:
+                std::tie(energy, energy_std) = run_orbitals<JastrowType::SIMPLE_JASTROW>(result, param, r1, r2, cache.get(), basis, telemetry.get());
+                break;
+            case JastrowType::PADE_JASTROW:
+                std::tie(energy, energy_std) = run_orbitals<JastrowType::PADE_JASTROW>(result, param, r1, r2, cache.get(), basis, telemetry.get());
+                break;
+            case JastrowType::EN_PADE_JASTROW:
+                std::tie(energy, energy_std) = run_orbitals<JastrowType::EN_PADE_JASTROW>(result, param, r1, r2, cache.get(), basis, telemetry.get());
+                break;
+        }
+        fmt::print("{:>20s}\t{:>20s}\n", "Energy (eV rel. 2H)", "Energy Std");
+        fmt::print("{:>20.8f}\t{:>20.8f}\n", (energy+1)*Hartree, energy_std);
+    } catch(const std::exception& e) {
+        fmt::print(stderr, "{}\n", e.what());
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file
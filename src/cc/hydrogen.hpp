@@ -1,18 +1,128 @@
 #pragma once
 #include <fmt/core.h>
 #include <Eigen/Dense>
+#include <memory>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "basis.hpp"
+#include "dual.hpp"
+#include "estimators.hpp"
+#include "result_cache.hpp"
+#include "telemetry.hpp"
+#include "walker.hpp"
 
 template<typename T>
 using PCoord = Eigen::Matrix<T, 1, 3>;
 
+// One value per walker for a block of walkers
+template<typename T>
+using BArray = Eigen::Array<T, Eigen::Dynamic, 1>;
+
+// Coordinates of one electron for a block of walkers, structure-of-arrays
+template<typename T>
+struct BCoord {
+    BArray<T> x, y, z;
+
+    BCoord(Eigen::Index n=0): x(n), y(n), z(n) {}
+
+    Eigen::Index size() const {
+        return x.size();
+    }
+
+    void resize(Eigen::Index n) {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+    }
+
+    BCoord operator-(const PCoord<T>& R) const {
+        BCoord ret;
+        ret.x = x - R(0);
+        ret.y = y - R(1);
+        ret.z = z - R(2);
+        return ret;
+    }
+
+    BCoord operator-(const BCoord& other) const {
+        BCoord ret;
+        ret.x = x - other.x;
+        ret.y = y - other.y;
+        ret.z = z - other.z;
+        return ret;
+    }
+
+    BArray<T> norm() const {
+        return (x.square() + y.square() + z.square()).sqrt();
+    }
+
+    BArray<T> dot(const BCoord& other) const {
+        return x*other.x + y*other.y + z*other.z;
+    }
+
+    PCoord<T> row(Eigen::Index i) const {
+        return PCoord<T>(x(i), y(i), z(i));
+    }
+
+    void set_row(Eigen::Index i, const PCoord<T>& r) {
+        x(i) = r(0);
+        y(i) = r(1);
+        z(i) = r(2);
+    }
+
+    // the walkers of the indices, in their order
+    void gather(const BCoord& from, const std::vector<Eigen::Index>& index) {
+        resize(index.size());
+        for(size_t i=0; i<index.size(); i++) {
+            x(i) = from.x(index[i]);
+            y(i) = from.y(index[i]);
+            z(i) = from.z(index[i]);
+        }
+    }
+};
+
 enum JastrowType {
-    SIMPLE_JASTROW,
+    SIMPLE_JASTROW,  // e-e Pade with fixed F
+    PADE_JASTROW,    // e-e Pade with free a, b
+    EN_PADE_JASTROW, // cusp e-e Pade plus e-n Pade terms
+};
+
+// Name of the Jastrow factor on the command line
+inline JastrowType parse_jastrow(const std::string& name) {
+    if(name == "simple") return JastrowType::SIMPLE_JASTROW;
+    if(name == "pade") return JastrowType::PADE_JASTROW;
+    if(name == "en-pade") return JastrowType::EN_PADE_JASTROW;
+    throw std::runtime_error("Invalid jastrow function: " + name);
+}
+
+// The parameters of JastrowParam a Jastrow factor uses, by their option names
+inline const std::vector<std::string>& jastrow_params(JastrowType type) {
+    static const std::vector<std::string> simple = {"F"}, pade = {"a", "b"}, en_pade = {"b", "aen", "ben"};
+    switch(type) {
+        case JastrowType::PADE_JASTROW: return pade;
+        case JastrowType::EN_PADE_JASTROW: return en_pade;
+        default: return simple;
+    }
+}
+
+// Parameters of the Jastrow factors, those not used by a JastrowType are ignored.
+// The defaults of b and the e-n term minimize the variance of EN_PADE_JASTROW
+// around c = 0, alpha = 1 to 1.2, see benchmark.x
+template<typename T>
+struct JastrowParam {
+    JastrowParam(T factor=1.0, T a=0.5, T b=0.3, T a_en=0.2, T b_en=1.5):
+        factor(factor), a(a), b(b), a_en(a_en), b_en(b_en) {}
+    T factor;   // F of SIMPLE_JASTROW
+    T a, b;     // e-e term $$u(r) = -\frac{ar}{1+br}$$
+    T a_en, b_en; // e-n term $$u(r) = \frac{ar^2}{1+br}$$
 };
 
 enum AtomicWfnType {
     VB,
     MO,
+    BASIS,
 };
 
 template<typename T>
@@ -27,6 +137,43 @@ public:
     
     // return laplacian of the wave function
     virtual T laplace(const PCoord<T>&)=0;
+
+    // Log domain, ln|psi|
+    virtual T log_value(const PCoord<T>& r) {
+        return std::log(std::abs(value(r)));
+    }
+
+    // $$\nabla \ln\psi$$ and $$\nabla^2 \ln\psi = \frac{\nabla^2\psi}{\psi} - |\nabla \ln\psi|^2$$
+    virtual void log_derivs(const PCoord<T>& r, PCoord<T>& grad_log, T& lap_log) {
+        auto val = value(r);
+        grad_log = grad(r)/val;
+        lap_log = laplace(r)/val - grad_log.squaredNorm();
+    }
+
+    // Batched over walkers, the default loops over the walkers
+    virtual void value_batch(const BCoord<T>& coord, BArray<T>& val) {
+        val.resize(coord.size());
+        for(Eigen::Index i=0; i<coord.size(); i++) val(i) = value(coord.row(i));
+    }
+
+    virtual void log_value_batch(const BCoord<T>& coord, BArray<T>& val) {
+        value_batch(coord, val);
+        val = val.abs().log();
+    }
+
+    // value, grad and laplacian in one pass
+    virtual void evaluate_batch(const BCoord<T>& coord, BArray<T>& val, BCoord<T>& grad, BArray<T>& lap) {
+        auto n = coord.size();
+        val.resize(n);
+        grad.resize(n);
+        lap.resize(n);
+        for(Eigen::Index i=0; i<n; i++) {
+            auto r = coord.row(i);
+            val(i) = value(r);
+            grad.set_row(i, this->grad(r));
+            lap(i) = laplace(r);
+        }
+    }
 };
 
 // Simple Wave function $$\phi(r) = (1+cr)e^{-\alpha r}$$
@@ -55,13 +202,60 @@ public:
         return (c*(ar*(ar-4)+2) + alpha*(ar-2))*std::exp(-ar)/r;
     }
 
+    // $$\ln|\psi| = \ln|1+cr| - \alpha r$$, also past the node of c < 0
+    T log_value(const PCoord<T>& r) {
+        auto d = r.norm();
+        return std::log(std::abs(1 + c*d)) - alpha*d;
+    }
+
+    void log_derivs(const PCoord<T>& r, PCoord<T>& grad_log, T& lap_log) {
+        auto d = r.norm();
+        auto cr = 1/(1 + c*d);
+        auto df = c*cr - alpha;
+        grad_log = df/d*r;
+        lap_log = -c*c*cr*cr + 2*df/d;
+    }
+
+    // Eigen evaluates exp and sqrt with SIMD across the walkers
+    void value_batch(const BCoord<T>& coord, BArray<T>& val) {
+        BArray<T> r = coord.norm();
+        val = (1 + c*r)*(-alpha*r).exp();
+    }
+
+    void log_value_batch(const BCoord<T>& coord, BArray<T>& val) {
+        BArray<T> r = coord.norm();
+        val = (1 + c*r).abs().log() - alpha*r;
+    }
+
+    void evaluate_batch(const BCoord<T>& coord, BArray<T>& val, BCoord<T>& grad, BArray<T>& lap) {
+        BArray<T> r = coord.norm();
+        BArray<T> ar = alpha*r;
+        BArray<T> e = (-ar).exp();
+        BArray<T> rinv = r.inverse();
+        val = (1 + c*r)*e;
+        BArray<T> coeff = (c - alpha*(c*r + 1))*e*rinv;
+        grad.x = coeff*coord.x;
+        grad.y = coeff*coord.y;
+        grad.z = coeff*coord.z;
+        lap = (c*(ar*(ar - 4) + 2) + alpha*(ar - 2))*e*rinv;
+    }
+
 private:
     T c, alpha;
 };
 
+// One-electron wave function of the molecule, centered on the nuclei R1 and R2
+template<typename T>
+class MolWaveFn: public WaveFn<T> {
+public:
+    virtual ~MolWaveFn(){};
+    // return the gradients of the wave function w.r.t. R1 and R2
+    virtual std::pair<PCoord<T>, PCoord<T>> nuclear_grad(const PCoord<T>&)=0;
+};
+
 // Composed Wave functions: VB
 template<typename T>
-class VBWaveFn: public WaveFn<T> {
+class VBWaveFn: public MolWaveFn<T> {
 public:
     VBWaveFn(T c, T alpha, const PCoord<T>& R1, const PCoord<T>& R2): 
         c(c), alpha(alpha), R1(R1), R2(R2) {
@@ -88,6 +282,52 @@ public:
                2*(phi1->grad(r-R1)).dot(phi2->grad(r-R2));
     }
 
+    // $$\partial_{R_1} \phi(r-R_1) = -\nabla \phi(r-R_1)$$
+    std::pair<PCoord<T>, PCoord<T>> nuclear_grad(const PCoord<T>& r) {
+        return {-phi2->value(r-R2)*phi1->grad(r-R1),
+                -phi1->value(r-R1)*phi2->grad(r-R2)};
+    }
+
+    // the product is a sum in the log domain
+    T log_value(const PCoord<T>& r) {
+        return phi1->log_value(r-R1) + phi2->log_value(r-R2);
+    }
+
+    void log_derivs(const PCoord<T>& r, PCoord<T>& grad_log, T& lap_log) {
+        PCoord<T> grad2;
+        T lap2;
+        phi1->log_derivs(r-R1, grad_log, lap_log);
+        phi2->log_derivs(r-R2, grad2, lap2);
+        grad_log += grad2;
+        lap_log += lap2;
+    }
+
+    void value_batch(const BCoord<T>& coord, BArray<T>& val) {
+        BArray<T> val2;
+        phi1->value_batch(coord - R1, val);
+        phi2->value_batch(coord - R2, val2);
+        val *= val2;
+    }
+
+    void log_value_batch(const BCoord<T>& coord, BArray<T>& val) {
+        BArray<T> val2;
+        phi1->log_value_batch(coord - R1, val);
+        phi2->log_value_batch(coord - R2, val2);
+        val += val2;
+    }
+
+    void evaluate_batch(const BCoord<T>& coord, BArray<T>& val, BCoord<T>& grad, BArray<T>& lap) {
+        BArray<T> val1, val2, lap1, lap2;
+        BCoord<T> grad1, grad2;
+        phi1->evaluate_batch(coord - R1, val1, grad1, lap1);
+        phi2->evaluate_batch(coord - R2, val2, grad2, lap2);
+        val = val1*val2;
+        grad.x = val2*grad1.x + val1*grad2.x;
+        grad.y = val2*grad1.y + val1*grad2.y;
+        grad.z = val2*grad1.z + val1*grad2.z;
+        lap = val2*lap1 + val1*lap2 + 2*grad1.dot(grad2);
+    }
+
 private:
     T c, alpha;
     PCoord<T> R1, R2;
@@ -97,7 +337,7 @@ private:
 
 // Composed Wave functions: MO
 template <typename T>
-class MOWaveFn: public WaveFn<T> {
+class MOWaveFn: public MolWaveFn<T> {
 public:
     MOWaveFn(T c, T alpha, const PCoord<T>& R1, const PCoord<T>& R2): 
         c(c), alpha(alpha), R1(R1), R2(R2) {
@@ -117,6 +357,64 @@ public:
         return phi1->laplace(r-R1) + phi2->laplace(r-R2);
     }
 
+    std::pair<PCoord<T>, PCoord<T>> nuclear_grad(const PCoord<T>& r) {
+        return {-phi1->grad(r-R1), -phi2->grad(r-R2)};
+    }
+
+    // The sum by log-sum-exp, $$\ln|\phi_1 + \phi_2| = l_> + \ln(1 + s e^{-|l_1 - l_2|})$$
+    // with $$l_i = \ln|1 + c r_i| - \alpha r_i$$ and s the sign of $$(1 + c r_1)(1 + c r_2)$$,
+    // nothing underflows far from both nuclei
+    T log_value(const PCoord<T>& r) {
+        auto d1 = (r - R1).norm(), d2 = (r - R2).norm();
+        auto u1 = 1 + c*d1, u2 = 1 + c*d2;
+        auto l1 = std::log(std::abs(u1)) - alpha*d1, l2 = std::log(std::abs(u2)) - alpha*d2;
+        auto e = std::exp(-std::abs(l1 - l2));
+        return std::max(l1, l2) + std::log1p(u1*u2 < 0 ? -e : e);
+    }
+
+    // the weights $$w_i = \phi_i e^{-l_>}$$ of the two log derivatives
+    void log_derivs(const PCoord<T>& r, PCoord<T>& grad_log, T& lap_log) {
+        auto d1 = (r - R1).norm(), d2 = (r - R2).norm();
+        auto u1 = 1 + c*d1, u2 = 1 + c*d2;
+        auto l1 = std::log(std::abs(u1)) - alpha*d1, l2 = std::log(std::abs(u2)) - alpha*d2;
+        auto lmax = std::max(l1, l2);
+        auto w1 = std::copysign(std::exp(l1 - lmax), u1), w2 = std::copysign(std::exp(l2 - lmax), u2);
+        PCoord<T> g1, g2;
+        T lap1, lap2;
+        phi1->log_derivs(r-R1, g1, lap1);
+        phi2->log_derivs(r-R2, g2, lap2);
+        auto w = w1 + w2;
+        grad_log = (w1*g1 + w2*g2)/w;
+        lap_log = (w1*(lap1 + g1.squaredNorm()) + w2*(lap2 + g2.squaredNorm()))/w - grad_log.squaredNorm();
+    }
+
+    void value_batch(const BCoord<T>& coord, BArray<T>& val) {
+        BArray<T> val2;
+        phi1->value_batch(coord - R1, val);
+        phi2->value_batch(coord - R2, val2);
+        val += val2;
+    }
+
+    void log_value_batch(const BCoord<T>& coord, BArray<T>& val) {
+        BArray<T> d1 = (coord - R1).norm(), d2 = (coord - R2).norm();
+        BArray<T> u1 = 1 + c*d1, u2 = 1 + c*d2;
+        BArray<T> l1 = u1.abs().log() - alpha*d1, l2 = u2.abs().log() - alpha*d2;
+        BArray<T> e = (-(l1 - l2).abs()).exp();
+        val = l1.max(l2) + (u1*u2 < 0).select(-e, e).log1p();
+    }
+
+    void evaluate_batch(const BCoord<T>& coord, BArray<T>& val, BCoord<T>& grad, BArray<T>& lap) {
+        BArray<T> val2, lap2;
+        BCoord<T> grad2;
+        phi1->evaluate_batch(coord - R1, val, grad, lap);
+        phi2->evaluate_batch(coord - R2, val2, grad2, lap2);
+        val += val2;
+        grad.x += grad2.x;
+        grad.y += grad2.y;
+        grad.z += grad2.z;
+        lap += lap2;
+    }
+
 private:
     T c, alpha;
     PCoord<T> R1, R2;
@@ -124,10 +422,132 @@ private:
     AtomicWaveFn<T>* phi2;
 };
 
+// Molecular orbital of a basis set file (see BasisOrbital), the atoms of
+// the file are put on R1 and R2
+template <typename T>
+class BasisWaveFn: public MolWaveFn<T> {
+public:
+    BasisWaveFn(const MoldenFile<T>& file, int orbital, const PCoord<T>& R1, const PCoord<T>& R2):
+        orbital(file, orbital, centers(file, R1, R2)) {}
+
+    T value(const PCoord<T>& r) {
+        return orbital.value(r);
+    }
+
+    PCoord<T> grad(const PCoord<T>& r) {
+        T val, lap;
+        PCoord<T> ret;
+        orbital.evaluate(r, val, ret, lap);
+        return ret;
+    }
+
+    T laplace(const PCoord<T>& r) {
+        T val, ret;
+        PCoord<T> grad;
+        orbital.evaluate(r, val, grad, ret);
+        return ret;
+    }
+
+    void log_derivs(const PCoord<T>& r, PCoord<T>& grad_log, T& lap_log) {
+        T val, lap;
+        orbital.evaluate(r, val, grad_log, lap);
+        grad_log /= val;
+        lap_log = lap/val - grad_log.squaredNorm();
+    }
+
+    std::pair<PCoord<T>, PCoord<T>> nuclear_grad(const PCoord<T>& r) {
+        T val, lap;
+        PCoord<T> grad;
+        orbital.evaluate(r, val, grad, lap, &atom_grad);
+        return {-atom_grad[0], -atom_grad[1]};
+    }
+
+private:
+    BasisOrbital<T> orbital;
+    std::vector<PCoord<T>> atom_grad;
+
+    static std::vector<PCoord<T>> centers(const MoldenFile<T>& file, const PCoord<T>& R1, const PCoord<T>& R2) {
+        if(file.atoms.size() != 2) throw std::runtime_error("The basis of H2 needs two atoms");
+        if(file.charges[0] != 1 || file.charges[1] != 1) {
+            throw std::runtime_error(fmt::format("The basis of H2 needs two hydrogen atoms, has charges {} and {}",
+                                                 file.charges[0], file.charges[1]));
+        }
+        return {R1, R2};
+    }
+};
+
+// Two-electron wave function, i.e. the Jastrow factor
+template<typename T>
+class PairWaveFn {
+public:
+    virtual ~PairWaveFn(){};
+    // return the value of wave function
+    virtual T value(const PCoord<T>&, const PCoord<T>&)=0;
+
+    // return the gradients w.r.t. r1 and r2
+    virtual std::pair<PCoord<T>, PCoord<T>> grad(const PCoord<T>&, const PCoord<T>&)=0;
+
+    // return the laplacians w.r.t. r1 and r2
+    virtual std::pair<T, T> laplace(const PCoord<T>&, const PCoord<T>&)=0;
+
+    // return the gradients w.r.t. the nuclei R1 and R2, zero for e-e terms
+    virtual std::pair<PCoord<T>, PCoord<T>> nuclear_grad(const PCoord<T>&, const PCoord<T>&) {
+        return {PCoord<T>::Zero(), PCoord<T>::Zero()};
+    }
+
+    // Log domain, ln|J|
+    virtual T log_value(const PCoord<T>& r1, const PCoord<T>& r2) {
+        return std::log(std::abs(value(r1, r2)));
+    }
+
+    // $$\nabla_i \ln J$$ and $$\nabla_i^2 \ln J$$ of both electrons
+    virtual void log_derivs(const PCoord<T>& r1, const PCoord<T>& r2, PCoord<T>& grad1, PCoord<T>& grad2,
+                            T& lap1, T& lap2) {
+        auto val = value(r1, r2);
+        std::tie(grad1, grad2) = grad(r1, r2);
+        std::tie(lap1, lap2) = laplace(r1, r2);
+        grad1 /= val;
+        grad2 /= val;
+        lap1 = lap1/val - grad1.squaredNorm();
+        lap2 = lap2/val - grad2.squaredNorm();
+    }
+
+    // Batched over walkers, the default loops over the walkers
+    virtual void value_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& val) {
+        val.resize(r1.size());
+        for(Eigen::Index i=0; i<r1.size(); i++) val(i) = value(r1.row(i), r2.row(i));
+    }
+
+    virtual void log_value_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& val) {
+        val.resize(r1.size());
+        for(Eigen::Index i=0; i<r1.size(); i++) val(i) = log_value(r1.row(i), r2.row(i));
+    }
+
+    // value, grads and laplacians in one pass
+    virtual void evaluate_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& val,
+                                BCoord<T>& grad1, BCoord<T>& grad2, BArray<T>& lap1, BArray<T>& lap2) {
+        auto n = r1.size();
+        val.resize(n);
+        grad1.resize(n);
+        grad2.resize(n);
+        lap1.resize(n);
+        lap2.resize(n);
+        for(Eigen::Index i=0; i<n; i++) {
+            auto p1 = r1.row(i), p2 = r2.row(i);
+            val(i) = value(p1, p2);
+            auto g = grad(p1, p2);
+            auto l = laplace(p1, p2);
+            grad1.set_row(i, g.first);
+            grad2.set_row(i, g.second);
+            lap1(i) = l.first;
+            lap2(i) = l.second;
+        }
+    }
+};
+
 // Define Jastrow wavefunction
 template<typename T>
-// class JastrowWfn: public WaveFn<T> {
-class JastrowWfn {
+class JastrowWfn: public PairWaveFn<T> {
 public:
     JastrowWfn(T factor): factor(factor) {}
 
@@ -156,6 +576,49 @@ public:
         auto ret = (dv*dv - d2v)*val;
         return {ret, ret};
     }
+
+    // ln J = -u, no exp
+    T log_value(const PCoord<T>& r1, const PCoord<T>& r2) {
+        return -ufunc(r1, r2);
+    }
+
+    void log_derivs(const PCoord<T>& r1, const PCoord<T>& r2, PCoord<T>& grad1, PCoord<T>& grad2,
+                    T& lap1, T& lap2) {
+        auto r12 = r1 - r2;
+        auto r = r12.norm();
+        auto fr = 1/(1 + r/factor);
+        grad1 = fr*fr/(2*r)*r12;
+        grad2 = -grad1;
+        lap1 = lap2 = fr*fr*fr/r;
+    }
+
+    void value_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& val) {
+        BArray<T> r = (r1 - r2).norm();
+        val = (-factor/(2 + 2*r/factor)).exp();
+    }
+
+    void log_value_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& val) {
+        BArray<T> r = (r1 - r2).norm();
+        val = -factor/(2 + 2*r/factor);
+    }
+
+    void evaluate_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& val,
+                        BCoord<T>& grad1, BCoord<T>& grad2, BArray<T>& lap1, BArray<T>& lap2) {
+        BCoord<T> r12 = r1 - r2;
+        BArray<T> r = r12.norm();
+        BArray<T> fr = (1 + r/factor).inverse();
+        val = (-0.5*factor*fr).exp();
+        // -dv/r*val with dv = -1/(2(1+r/F)^2)
+        BArray<T> coeff = 0.5*fr.square()*val/r;
+        grad1.x = coeff*r12.x;
+        grad1.y = coeff*r12.y;
+        grad1.z = coeff*r12.z;
+        grad2.x = -grad1.x;
+        grad2.y = -grad1.y;
+        grad2.z = -grad1.z;
+        lap1 = (0.25*fr.square().square() + fr.cube()/r)*val;
+        lap2 = lap1;
+    }
 private:
     T factor;
     inline T ufunc(const PCoord<T>& r1, const PCoord<T> r2) {
@@ -164,18 +627,326 @@ private:
     }
 };
 
+// Pade Jastrow factor $$e^{-u(r_{12})}, u(r) = -\frac{ar}{1+br}$$
+// $$u'(r) = -\frac{a}{(1+br)^2}, u''(r) = \frac{2ab}{(1+br)^3}$$
+// The e-e cusp of the singlet is satisfied with a = 1/2
+template<typename T>
+class PadeJastrowWfn: public PairWaveFn<T> {
+public:
+    PadeJastrowWfn(T a, T b): a(a), b(b) {}
+
+    ~PadeJastrowWfn() {}
+
+    T value(const PCoord<T>& r1, const PCoord<T>& r2) {
+        auto r = (r1 - r2).norm();
+        return std::exp(a*r/(1 + b*r));
+    }
+
+    std::pair<PCoord<T>, PCoord<T>>
+    grad(const PCoord<T>& r1, const PCoord<T>& r2) {
+        auto r12 = r1 - r2;
+        auto r = r12.norm();
+        auto br = 1 + b*r;
+        PCoord<T> ret = std::exp(a*r/br)*a/(br*br)*r12/r;
+        return {ret, -ret};
+    }
+
+    std::pair<T, T>
+    laplace(const PCoord<T>& r1, const PCoord<T>& r2) {
+        auto r = (r1 - r2).norm();
+        auto br = 1 + b*r;
+        auto du = -a/(br*br);
+        auto lu = 2*a*b/(br*br*br) + 2*du/r;
+        auto ret = (du*du - lu)*std::exp(a*r/br);
+        return {ret, ret};
+    }
+
+    T log_value(const PCoord<T>& r1, const PCoord<T>& r2) {
+        auto r = (r1 - r2).norm();
+        return a*r/(1 + b*r);
+    }
+
+    void log_derivs(const PCoord<T>& r1, const PCoord<T>& r2, PCoord<T>& grad1, PCoord<T>& grad2,
+                    T& lap1, T& lap2) {
+        auto r12 = r1 - r2;
+        auto r = r12.norm();
+        auto br = 1/(1 + b*r);
+        auto du = -a*br*br;
+        grad1 = -du/r*r12;
+        grad2 = -grad1;
+        lap1 = lap2 = -2*a*b*br*br*br - 2*du/r;
+    }
+
+    void value_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& val) {
+        BArray<T> r = (r1 - r2).norm();
+        val = (a*r/(1 + b*r)).exp();
+    }
+
+    void log_value_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& val) {
+        BArray<T> r = (r1 - r2).norm();
+        val = a*r/(1 + b*r);
+    }
+
+    void evaluate_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& val,
+                        BCoord<T>& grad1, BCoord<T>& grad2, BArray<T>& lap1, BArray<T>& lap2) {
+        BCoord<T> r12 = r1 - r2;
+        BArray<T> r = r12.norm();
+        BArray<T> rinv = r.inverse();
+        BArray<T> brinv = (1 + b*r).inverse();
+        val = (a*r*brinv).exp();
+        BArray<T> du = -a*brinv.square();
+        BArray<T> coeff = -du*val*rinv;
+        grad1.x = coeff*r12.x;
+        grad1.y = coeff*r12.y;
+        grad1.z = coeff*r12.z;
+        grad2.x = -grad1.x;
+        grad2.y = -grad1.y;
+        grad2.z = -grad1.z;
+        lap1 = (du.square() - 2*a*b*brinv.cube() - 2*du*rinv)*val;
+        lap2 = lap1;
+    }
+
+private:
+    T a, b;
+};
+
+// Pade Jastrow factor with e-e and e-n terms,
+// $$J = e^{-u(r_{12}) - \sum_{iI} v(r_{iI})}, v(r) = \frac{a_{en}r^2}{1+b_{en}r}$$
+// $$v'(r) = \frac{a_{en}r(2+b_{en}r)}{(1+b_{en}r)^2}, v''(r) = \frac{2a_{en}}{(1+b_{en}r)^3}$$
+// u(r) is the cusp Pade term, v(r) has zero slope at the nuclei,
+// so the nuclear cusp of the atomic wave function is kept
+template<typename T>
+class ENPadeJastrowWfn: public PairWaveFn<T> {
+public:
+    ENPadeJastrowWfn(T b, T a_en, T b_en, const PCoord<T>& R1, const PCoord<T>& R2):
+        b(b), a_en(a_en), b_en(b_en), R1(R1), R2(R2) {}
+
+    ~ENPadeJastrowWfn() {}
+
+    T value(const PCoord<T>& r1, const PCoord<T>& r2) {
+        return std::exp(-ufunc(r1, r2));
+    }
+
+    std::pair<PCoord<T>, PCoord<T>>
+    grad(const PCoord<T>& r1, const PCoord<T>& r2) {
+        auto val = value(r1, r2);
+        PCoord<T> du1, du2;
+        T lu1, lu2;
+        derivs(r1, r2, du1, du2, lu1, lu2);
+        return {-val*du1, -val*du2};
+    }
+
+    std::pair<T, T>
+    laplace(const PCoord<T>& r1, const PCoord<T>& r2) {
+        auto val = value(r1, r2);
+        PCoord<T> du1, du2;
+        T lu1, lu2;
+        derivs(r1, r2, du1, du2, lu1, lu2);
+        return {(du1.squaredNorm() - lu1)*val, (du2.squaredNorm() - lu2)*val};
+    }
+
+    T log_value(const PCoord<T>& r1, const PCoord<T>& r2) {
+        return -ufunc(r1, r2);
+    }
+
+    void log_derivs(const PCoord<T>& r1, const PCoord<T>& r2, PCoord<T>& grad1, PCoord<T>& grad2,
+                    T& lap1, T& lap2) {
+        derivs(r1, r2, grad1, grad2, lap1, lap2);
+        grad1 = -grad1;
+        grad2 = -grad2;
+        lap1 = -lap1;
+        lap2 = -lap2;
+    }
+
+    // $$\partial_{R_I} J = J \sum_i v'(r_{iI}) \frac{\mathbf{r_i}-\mathbf{R_I}}{r_{iI}}$$
+    std::pair<PCoord<T>, PCoord<T>>
+    nuclear_grad(const PCoord<T>& r1, const PCoord<T>& r2) {
+        auto val = value(r1, r2);
+        PCoord<T> dv1 = PCoord<T>::Zero(), dv2 = PCoord<T>::Zero();
+        T lv = 0.0;
+        en_derivs(r1-R1, dv1, lv);
+        en_derivs(r2-R1, dv1, lv);
+        en_derivs(r1-R2, dv2, lv);
+        en_derivs(r2-R2, dv2, lv);
+        return {val*dv1, val*dv2};
+    }
+
+private:
+    const T a = 0.5;
+    T b, a_en, b_en;
+    PCoord<T> R1, R2;
+
+    inline T ufunc(const PCoord<T>& r1, const PCoord<T>& r2) {
+        auto r = (r1 - r2).norm();
+        return -a*r/(1 + b*r) + vfunc((r1-R1).norm()) + vfunc((r1-R2).norm()) +
+               vfunc((r2-R1).norm()) + vfunc((r2-R2).norm());
+    }
+
+    inline T vfunc(T d) {
+        return a_en*d*d/(1 + b_en*d);
+    }
+
+    // add the gradient and laplacian of the e-n term of one electron
+    inline void en_derivs(const PCoord<T>& rI, PCoord<T>& du, T& lu) {
+        auto d = rI.norm();
+        auto bd = 1 + b_en*d;
+        auto dv = a_en*d*(2 + b_en*d)/(bd*bd);
+        du += dv*rI/d;
+        lu += 2*a_en/(bd*bd*bd) + 2*dv/d;
+    }
+
+    // gradients and laplacians of u + v w.r.t. r1 and r2
+    void derivs(const PCoord<T>& r1, const PCoord<T>& r2,
+                PCoord<T>& du1, PCoord<T>& du2, T& lu1, T& lu2) {
+        auto r12 = r1 - r2;
+        auto r = r12.norm();
+        auto br = 1 + b*r;
+        auto du = -a/(br*br);
+        du1 = du*r12/r;
+        du2 = -du1;
+        lu1 = lu2 = 2*a*b/(br*br*br) + 2*du/r;
+        en_derivs(r1-R1, du1, lu1);
+        en_derivs(r1-R2, du1, lu1);
+        en_derivs(r2-R1, du2, lu2);
+        en_derivs(r2-R2, du2, lu2);
+    }
+};
+
+// Trial functions written once against Dual<T, N>,
+// the derivatives are generated by the compiler
+// Simple Wave function $$\phi(r) = (1+cr)e^{-\alpha r}$$
+template<typename T>
+struct AtomicOrbital {
+    T c, alpha;
+
+    template<int N>
+    EIGEN_ALWAYS_INLINE Dual<T, N> operator()(const DualCoord<T, N>& coord) const {
+        auto r = norm(coord);
+        return (1 + c*r)*exp(-alpha*r);
+    }
+};
+
+// Simple Jastrow factor $$e^{-u(r_{12})}, u(r) = \frac{F}{2(1+r/F)}$$
+template<typename T>
+struct SimpleJastrow {
+    T factor;
+
+    template<int N>
+    EIGEN_ALWAYS_INLINE Dual<T, N> operator()(const DualCoord<T, N>& r1, const DualCoord<T, N>& r2) const {
+        auto r = norm(r1 - r2);
+        return exp(-factor/(2 + 2*r/factor));
+    }
+};
+
+// One-electron wave function from an expression Fn,
+// evaluate() is the fused value/grad/laplace kernel
+template<typename T, typename Fn>
+class ADWaveFn: public WaveFn<T> {
+public:
+    ADWaveFn(const Fn& fn): fn(fn) {}
+    ~ADWaveFn() {}
+
+    void evaluate(const PCoord<T>& coord, T& val, PCoord<T>& grad, T& lap) {
+        auto ret = fn(variable<T, 1>(coord, 0));
+        val = ret.val;
+        grad = ret.grad;
+        lap = ret.lap(0);
+    }
+
+    T value(const PCoord<T>& coord) {
+        return fn(constant<T, 0>(coord)).val;
+    }
+
+    PCoord<T> grad(const PCoord<T>& coord) {
+        return fn(variable<T, 1>(coord, 0)).grad;
+    }
+
+    T laplace(const PCoord<T>& coord) {
+        return fn(variable<T, 1>(coord, 0)).lap(0);
+    }
+
+private:
+    Fn fn;
+};
+
+// Two-electron wave function from an expression Fn, same interface as JastrowWfn
+template<typename T, typename Fn>
+class ADJastrowWfn: public PairWaveFn<T> {
+public:
+    ADJastrowWfn(const Fn& fn): fn(fn) {}
+    ~ADJastrowWfn() {}
+
+    void evaluate(const PCoord<T>& r1, const PCoord<T>& r2, T& val,
+                  PCoord<T>& grad1, PCoord<T>& grad2, T& lap1, T& lap2) {
+        auto ret = fn(variable<T, 2>(r1, 0), variable<T, 2>(r2, 1));
+        val = ret.val;
+        grad1 = ret.grad.row(0);
+        grad2 = ret.grad.row(1);
+        lap1 = ret.lap(0);
+        lap2 = ret.lap(1);
+    }
+
+    inline T value(const PCoord<T>& r1, const PCoord<T>& r2) {
+        return fn(constant<T, 0>(r1), constant<T, 0>(r2)).val;
+    }
+
+    std::pair<PCoord<T>, PCoord<T>>
+    grad(const PCoord<T>& r1, const PCoord<T>& r2) {
+        auto ret = fn(variable<T, 2>(r1, 0), variable<T, 2>(r2, 1));
+        return {ret.grad.row(0), ret.grad.row(1)};
+    }
+
+    std::pair<T, T>
+    laplace(const PCoord<T>& r1, const PCoord<T>& r2) {
+        auto ret = fn(variable<T, 2>(r1, 0), variable<T, 2>(r2, 1));
+        return {ret.lap(0), ret.lap(1)};
+    }
+
+private:
+    Fn fn;
+};
+
+// Terms of the local energy, the potential is split by the pairs of particles
+template<typename T>
+struct EnergyComponents {
+    T kinetic, electron_nuclear, electron_electron, nuclear_nuclear;
+
+    T potential() const {
+        return electron_nuclear + electron_electron + nuclear_nuclear;
+    }
+
+    T total() const {
+        return kinetic + potential();
+    }
+};
+
 template<typename T, JastrowType Jastrow, AtomicWfnType AtomicWfn>
 class H2Mol {
 
 public:
+    typedef T Scalar;
+    typedef PCoord<T> Coord;
+    typedef EnergyComponents<T> Components;
+
     const JastrowType jastrow_type = Jastrow;
     const AtomicWfnType atomicwfn_type = AtomicWfn;
 
     H2Mol(T factor, T c, T alpha, const PCoord<T>& R1, const PCoord<T>& R2):
+        H2Mol(JastrowParam<T>(factor), c, alpha, R1, R2) {}
+
+    // the BASIS orbitals are the orbital of the basis file
+    H2Mol(const JastrowParam<T>& param, T c, T alpha, const PCoord<T>& R1, const PCoord<T>& R2,
+          const MoldenFile<T>* basis=nullptr, int orbital=0):
         R1(R1), R2(R2) {
         switch (Jastrow) {
             case JastrowType::SIMPLE_JASTROW:
-                jastrow = new JastrowWfn<T>(factor);
+                jastrow = new JastrowWfn<T>(param.factor);
+                break;
+            case JastrowType::PADE_JASTROW:
+                jastrow = new PadeJastrowWfn<T>(param.a, param.b);
+                break;
+            case JastrowType::EN_PADE_JASTROW:
+                jastrow = new ENPadeJastrowWfn<T>(param.b, param.a_en, param.b_en, R1, R2);
                 break;
             default:
                 throw std::runtime_error("Invalid jastrow function.");
@@ -189,6 +960,10 @@ public:
             case AtomicWfnType::VB:
                 atomicwfn = new VBWaveFn<T>(c, alpha, R1, R2);
                 break;
+            case AtomicWfnType::BASIS:
+                if(!basis) throw std::runtime_error("The BASIS orbitals need a basis file");
+                atomicwfn = new BasisWaveFn<T>(*basis, orbital, R1, R2);
+                break;
             default:
                 throw std::runtime_error("Invalid atomic wave function");
                 break;
@@ -206,105 +981,619 @@ public:
                atomicwfn->value(r1)*atomicwfn->value(r2), 2);
     }
 
-    // Calculate the energy with current density
+    // ln|psi|, the sampling only needs differences of it
+    T logpsi(const PCoord<T>& r1, const PCoord<T>& r2) {
+        return jastrow->log_value(r1, r2) + atomicwfn->log_value(r1) + atomicwfn->log_value(r2);
+    }
+
+    // Calculate the energy with current density from the log derivatives,
+    // $$\frac{\nabla_i^2\psi}{\psi} = \nabla_i^2 \ln\psi + |\nabla_i \ln\psi|^2$$
     T energy(const PCoord<T>& r1, const PCoord<T>& r2) {
-        T ret = 0.0;
-        PCoord<T> dJdr1, dJdr2;
-        T d2Jdr1, d2Jdr2;
+        return energy_components(r1, r2).total();
+    }
+
+    // energy() split into kinetic and potential terms
+    EnergyComponents<T> energy_components(const PCoord<T>& r1, const PCoord<T>& r2) {
+        EnergyComponents<T> ret;
+        PCoord<T> g1, g2, ga1, ga2;
+        T l1, l2, la1, la2;
+        jastrow->log_derivs(r1, r2, g1, g2, l1, l2);
+        atomicwfn->log_derivs(r1, ga1, la1);
+        atomicwfn->log_derivs(r2, ga2, la2);
+        g1 += ga1;
+        g2 += ga2;
+        ret.kinetic = -0.5*(l1 + la1 + g1.squaredNorm() + l2 + la2 + g2.squaredNorm());
+
+        ret.electron_nuclear = -1.0/(r1-R1).norm() - 1.0/(r1-R2).norm()
+                               -1.0/(r2-R1).norm() - 1.0/(r2-R2).norm();
+        ret.electron_electron = 1.0/(r1-r2).norm();
+        ret.nuclear_nuclear = 1.0/(R1-R2).norm();
+
+        return ret;
+    }
+
+    std::pair<PCoord<T>, PCoord<T>> geometry() const {
+        return {R1, R2};
+    }
+
+    // logpsi() of a block of walkers
+    void logpsi_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& out) {
+        BArray<T> val1, val2;
+        jastrow->log_value_batch(r1, r2, out);
+        atomicwfn->log_value_batch(r1, val1);
+        atomicwfn->log_value_batch(r2, val2);
+        out += val1 + val2;
+    }
+
+    // density() of a block of walkers
+    void density_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& out) {
+        BArray<T> val1, val2;
+        jastrow->value_batch(r1, r2, out);
+        atomicwfn->value_batch(r1, val1);
+        atomicwfn->value_batch(r2, val2);
+        out = (out*val1*val2).square();
+    }
+
+    // energy() of a block of walkers
+    void energy_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& out) {
+        BArray<T> en, ee;
+        energy_components_batch(r1, r2, out, en, ee);
+        out += en + ee + 1.0/(R1 - R2).norm();
+    }
+
+    // energy_components() of a block of walkers, but for the constant e_nn
+    void energy_components_batch(const BCoord<T>& r1, const BCoord<T>& r2, BArray<T>& kinetic,
+                                 BArray<T>& electron_nuclear, BArray<T>& electron_electron) {
+        BArray<T> jval, jlap1, jlap2, val1, lap1, val2, lap2;
+        BCoord<T> jgrad1, jgrad2, grad1, grad2;
+        jastrow->evaluate_batch(r1, r2, jval, jgrad1, jgrad2, jlap1, jlap2);
+        atomicwfn->evaluate_batch(r1, val1, grad1, lap1);
+        atomicwfn->evaluate_batch(r2, val2, grad2, lap2);
+        BArray<T> jinv = jval.inverse(), inv1 = val1.inverse(), inv2 = val2.inverse();
+        kinetic = (jlap1 + jlap2)*jinv + lap1*inv1 + lap2*inv2
+                + 2*jgrad1.dot(grad1)*jinv*inv1 + 2*jgrad2.dot(grad2)*jinv*inv2;
+        kinetic *= -0.5;
+
+        electron_nuclear = -((r1 - R1).norm().inverse() + (r1 - R2).norm().inverse()
+                             + (r2 - R1).norm().inverse() + (r2 - R2).norm().inverse());
+        BCoord<T> r12 = r1 - r2;
+        electron_electron = r12.norm().inverse();
+    }
+
+    // Zero-variance Hellmann-Feynman forces f1, f2 on the nuclei and
+    // the derivatives dlog1, dlog2 of ln psi w.r.t. the nuclei (for the Pulay term)
+    // $$F_I = Z\sum_i \frac{\mathbf{g_i}}{r_{iI}} - \frac{\mathbf{r_{iI}}(\mathbf{r_{iI}}\cdot\mathbf{g_i})}{r_{iI}^3} + F_{nn}, \mathbf{g_i} = \nabla_i \ln\psi$$
+    void force(const PCoord<T>& r1, const PCoord<T>& r2, PCoord<T>& f1, PCoord<T>& f2,
+               PCoord<T>& dlog1, PCoord<T>& dlog2) {
+        PCoord<T> g1, g2, ga1, ga2, dJdR1, dJdR2, dpdR1, dpdR2;
+        T l1, l2;
+        jastrow->log_derivs(r1, r2, g1, g2, l1, l2);
+        atomicwfn->log_derivs(r1, ga1, l1);
+        atomicwfn->log_derivs(r2, ga2, l2);
+        g1 += ga1;
+        g2 += ga2;
+
+        f1 = zv_force(r1-R1, g1) + zv_force(r2-R1, g2);
+        f2 = zv_force(r1-R2, g1) + zv_force(r2-R2, g2);
+        PCoord<T> R12 = R1 - R2;
+        f1 += R12/std::pow(R12.norm(), 3);
+        f2 -= R12/std::pow(R12.norm(), 3);
+
         auto jval = jastrow->value(r1, r2);
-        std::tie(d2Jdr1, d2Jdr2) = jastrow->laplace(r1, r2);
-        std::tie(dJdr1, dJdr2) = jastrow->grad(r1, r2);
-        ret += (d2Jdr1+d2Jdr2)/jval;
         auto val1 = atomicwfn->value(r1);
         auto val2 = atomicwfn->value(r2);
-        ret += atomicwfn->laplace(r1)/val1;
-        ret += atomicwfn->laplace(r2)/val2;
-        
-        ret += 2*dJdr1.dot(atomicwfn->grad(r1))/(jval*val1);
-        ret += 2*dJdr2.dot(atomicwfn->grad(r2))/(jval*val2);
+        std::tie(dJdR1, dJdR2) = jastrow->nuclear_grad(r1, r2);
+        dlog1 = dJdR1/jval;
+        dlog2 = dJdR2/jval;
+        std::tie(dpdR1, dpdR2) = atomicwfn->nuclear_grad(r1);
+        dlog1 += dpdR1/val1;
+        dlog2 += dpdR2/val1;
+        std::tie(dpdR1, dpdR2) = atomicwfn->nuclear_grad(r2);
+        dlog1 += dpdR1/val2;
+        dlog2 += dpdR2/val2;
+    }
 
-        ret = -0.5*ret; // kintetic energy
+private:
+    PairWaveFn<T>* jastrow = nullptr;
+    MolWaveFn<T>* atomicwfn = nullptr;
+    PCoord<T> R1, R2;
 
-        ret += -1.0/(r1-R1).norm();
-        ret += -1.0/(r1-R2).norm();
-        ret += -1.0/(r2-R1).norm();
-        ret += -1.0/(r2-R2).norm();
-        ret += 1.0/(r1-r2).norm();
-        ret += 1.0/(R1-R2).norm();
+    // contribution of electron at rI = r - R_I with $$\nabla \ln\psi$$ = g
+    inline PCoord<T> zv_force(const PCoord<T>& rI, const PCoord<T>& g) {
+        auto d = rI.norm();
+        return g/d - rI*rI.dot(g)/(d*d*d);
+    }
+};
 
-        return ret;
+// Energy and forces on the nuclei with their standard errors
+template<typename T>
+struct H2Force {
+    T energy, energy_std;
+    PCoord<T> force1, force2;
+    PCoord<T> error1, error2;
+};
+
+// Images of a configuration under the symmetry of the bond, the D2h subgroup
+// of D_inf_h with the bond axis e and two perpendicular axes n1, n2. Every
+// element is an involution $$\mathbf{r} \to \mathbf{R_c} + L(\mathbf{r} - \mathbf{R_c})$$,
+// $$L = \pm e e^T \pm n_1 n_1^T \pm n_2 n_2^T$$, and swaps the nuclei when it flips e.
+// The trial functions are invariant under it and under the electron swap,
+// so the local energy is the same on every image, while a vector observable
+// of nucleus I maps as $$\mathbf{F_I}(gR) = L\mathbf{F_{g(I)}}(R)$$. Its
+// average over the images needs no more evaluations of the wave function
+template<typename T>
+class H2Symmetry {
+public:
+    typedef Eigen::Matrix<T, 3, 3> Mat3;
+
+    H2Symmetry(const PCoord<T>& R1, const PCoord<T>& R2): center(0.5*(R1 + R2)) {
+        PCoord<T> e = (R1 - R2).normalized();
+        // any axis perpendicular to e
+        PCoord<T> trial = std::abs(e(0)) < 0.9 ? PCoord<T>::UnitX() : PCoord<T>::UnitY();
+        PCoord<T> n1 = (trial - trial.dot(e)*e).normalized();
+        PCoord<T> n2 = e.cross(n1);
+        for(int g=0; g<nimage; g++) {
+            T se = g & 1 ? -1 : 1, s1 = g & 2 ? -1 : 1, s2 = g & 4 ? -1 : 1;
+            linear[g] = se*e.transpose()*e + s1*n1.transpose()*n1 + s2*n2.transpose()*n2;
+        }
+    }
+
+    static int size() {
+        return nimage;
+    }
+
+    // whether image g exchanges the nuclei
+    static bool swaps(int g) {
+        return g & 1;
+    }
+
+    PCoord<T> image(int g, const PCoord<T>& r) const {
+        return center + (r - center)*linear[g];
+    }
+
+    // replace the vectors v1, v2 of the nuclei by their average over the images
+    void average(PCoord<T>& v1, PCoord<T>& v2) const {
+        PCoord<T> a1 = PCoord<T>::Zero(), a2 = PCoord<T>::Zero();
+        for(int g=0; g<nimage; g++) {
+            a1 += (swaps(g) ? v2 : v1)*linear[g];
+            a2 += (swaps(g) ? v1 : v2)*linear[g];
+        }
+        v1 = a1/static_cast<T>(nimage);
+        v2 = a2/static_cast<T>(nimage);
     }
 
 private:
-    JastrowWfn<T>* jastrow = nullptr;
-    WaveFn<T>* atomicwfn = nullptr;
-    PCoord<T> R1, R2;
+    static const int nimage = 8;
+    PCoord<T> center;
+    Mat3 linear[nimage];
 };
 
 
-template<typename T> //, typename wfn>
+template<typename T, JastrowType Jastrow=JastrowType::SIMPLE_JASTROW,
+         AtomicWfnType AtomicWfn=AtomicWfnType::MO>
 class H2MolQMC {
 public:
-    H2MolQMC(T factor, T c, T alpha, const PCoord<T>& R1, const PCoord<T>& R2, T dr): dr(dr){
-        mol = new H2Mol<T, JastrowType::SIMPLE_JASTROW, AtomicWfnType::MO>(factor, c, alpha, R1, R2);
+    typedef H2Mol<T, Jastrow, AtomicWfn> Mol;
+
+    H2MolQMC(T factor, T c, T alpha, const PCoord<T>& R1, const PCoord<T>& R2, T dr):
+        H2MolQMC(JastrowParam<T>(factor), c, alpha, R1, R2, dr) {}
+
+    // basis and orbital are those of the BASIS orbitals
+    H2MolQMC(const JastrowParam<T>& param, T c, T alpha, const PCoord<T>& R1, const PCoord<T>& R2, T dr,
+             std::shared_ptr<const MoldenFile<T>> basis=nullptr, int orbital=0):
+        param(param), c(c), alpha(alpha), R1(R1), R2(R2), dr(dr), basis(basis), orbital(orbital) {
+        mol = new H2Mol<T, Jastrow, AtomicWfn>(param, c, alpha, R1, R2, basis.get(), orbital);
     }
 
     ~H2MolQMC() {
         delete mol;
     }
 
-    std::pair<T, T> sample(int maxstep=10000) {
-        
-        // Thsi method return the number between [-1, 1]
-        PCoord<T> r1 = PCoord<T>::Random(); 
-        PCoord<T> r2 = PCoord<T>::Random();
+    // Move the nuclei, the trial wave function follows them
+    void set_geometry(const PCoord<T>& R1_new, const PCoord<T>& R2_new) {
+        R1 = R1_new;
+        R2 = R2_new;
+        delete mol;
+        mol = new H2Mol<T, Jastrow, AtomicWfn>(param, c, alpha, R1, R2, basis.get(), orbital);
+    }
 
-        PCoord<T> r1_new, r2_new;
-        T energy = mol->energy(r1, r2);
-        T density = mol->density(r1, r2);
-        std::uniform_real_distribution<T> rnum(0, 1);
+    std::pair<PCoord<T>, PCoord<T>> geometry() const {
+        return {R1, R2};
+    }
 
-        //energy_old = mol->energy();
+    void seed(unsigned s) {
+        rgen.seed(s);
+    }
+
+    // print the progress of the sampling or not
+    void set_verbose(bool v) {
+        verbose = v;
+    }
+
+    T accept_ratio() const {
+        return accept_rate;
+    }
+
+    // average the forces and the estimators over the symmetry images of every
+    // sample, see H2Symmetry. A basis file need not share the symmetry of the
+    // nuclei, the images are only taken with the built-in orbitals
+    void set_symmetry(bool s) {
+        if(s && AtomicWfn == AtomicWfnType::BASIS)
+            throw std::invalid_argument("The symmetry images need the built-in orbitals, not a basis file");
+        symmetric = s;
+    }
+
+    // keep the energies of the next runs of sample() and sample_walkers()
+    // in blocks of nstep steps, 0 for one block per run
+    void set_block(long nstep) {
+        block = nstep;
+    }
+
+    const std::vector<Block<T>>& blocks() const {
+        return blocking.blocks();
+    }
+
+    // publish the progress of the next runs to telemetry, nullptr for none
+    void set_telemetry(Telemetry* t) {
+        telemetry = t;
+    }
+
+    // The estimators accumulate every `every` steps
+    std::pair<T, T> sample(int maxstep=10000, const std::vector<Estimator<Mol>*>& estimators={}, int every=1) {
+        if(every < 1) throw std::invalid_argument("Estimator interval must be at least 1");
+        // the estimators get the components of the local energy
+        EnergyComponents<T> components;
+        T energy;
         T energy_tot = 0.0;
         T energy_sq_tot = 0.0;
+        int step = 0;
+        blocking.reset(block);
+        auto progress = telemetry ? telemetry->begin(1, maxstep) : nullptr;
+        // update() also sees the starting configuration
+        int moved = -1;
+        auto accept = walk(maxstep, 
+            [&](const PCoord<T>& r1, const PCoord<T>& r2) {
+                components = mol->energy_components(r1, r2);
+                energy = components.total();
+                moved++;
+            },
+            [&](const PCoord<T>& r1, const PCoord<T>& r2) {
+                energy_tot += energy;
+                energy_sq_tot += energy*energy;
+                blocking.add(energy, energy*energy, 1);
+                if(progress) progress->add(energy, energy*energy, 1, moved, 1, dr);
+                moved = 0;
+                if(++step % every == 0) {
+                    for(auto est: estimators) accumulate(est, r1, r2, &components);
+                }
+            });
+        if(progress) progress->finish();
+        auto energy_avg = energy_tot/maxstep;
+        auto energy_std = std::sqrt(energy_sq_tot/maxstep - energy_avg*energy_avg);
+        if(verbose) fmt::print("Accept ratio: {}\n", (double) accept/maxstep);
+        return {energy_avg, energy_std};
+    }
+
+    // VMC with nwalker walkers stored in a WalkerPool and split over nthread
+    // threads, every thread first-touches its pages and then only moves its own
+    // slice. A pool under a page per thread is touched whole before the threads.
+    // One step moves every walker of the slice at once. Every thread accumulates
+    // into clones of the estimators every `every` steps, merged after the run.
+    std::pair<T, T> sample_walkers(int nwalker, int maxstep=10000, int nthread=1,
+                                   const std::vector<Estimator<Mol>*>& estimators={}, int every=1) {
+        if(every < 1) throw std::invalid_argument("Estimator interval must be at least 1");
+        // per thread accumulators, one cache line each
+        struct alignas(Arena::alignment) Accum {
+            T energy_tot, energy_sq_tot;
+            long accept, count;
+        };
+        Arena arena(WalkerPool<T>::bytes(2, nwalker) + nthread*sizeof(Accum));
+        WalkerPool<T> pool(arena, 2, nwalker);
+        auto accum = arena.allocate<Accum>(nthread);
+        for(int i=0; i<nwalker; i++) pool.add();
+        // too few walkers for a page per thread, one owner for all the pages
+        if(!pool.paged(nthread)) pool.touch(0, pool.size());
+        std::vector<unsigned> seeds(nthread);
+        for(auto& s: seeds) s = rgen();
+        std::vector<std::vector<std::unique_ptr<Estimator<Mol>>>> local(nthread);
+        std::vector<Blocking<T>> local_blocks(nthread);
+        for(auto& b: local_blocks) b.reset(block);
+        for(auto& l: local) {
+            for(auto est: estimators) l.emplace_back(est->clone());
+        }
+        auto progress = telemetry ? telemetry->begin(nthread, maxstep) : nullptr;
+
+        auto worker = [&](int tid) {
+            size_t begin, end;
+            std::tie(begin, end) = pool.slice(tid, nthread);
+            if(pool.paged(nthread)) pool.touch(begin, end);
+            Accum acc = {0.0, 0.0, 0, 0};
+            std::mt19937 gen(seeds[tid]);
+            std::uniform_real_distribution<T> dist(-1.0, 1.0);
+            auto coord = [&]() {
+                PCoord<T> ret;
+                ret << dist(gen), dist(gen), dist(gen);
+                return ret;
+            };
+            for(auto w=begin; w<end; w++) {
+                PCoord<T> r1 = coord(), r2 = coord();
+                pool.set_position(w, 0, r1);
+                pool.set_position(w, 1, r2);
+                pool.logpsi(w) = mol->logpsi(r1, r2);
+                set_components(pool, w, mol->energy_components(r1, r2));
+            }
+            // The block of walkers moves in lockstep: the proposals, densities
+            // and local energies are evaluated with the batched (SIMD) kernels
+            std::mt19937_64 gen64(gen());
+            auto n = static_cast<Eigen::Index>(end - begin);
+            typedef Eigen::Map<BArray<T>> MapArray;
+            MapArray logpsi(&pool.logpsi(0) + begin, n), eloc(&pool.eloc(0) + begin, n);
+            MapArray kinetic(&pool.component(0, 0) + begin, n), electron_nuclear(&pool.component(1, 0) + begin, n);
+            MapArray electron_electron(&pool.component(2, 0) + begin, n);
+            BCoord<T> r1(n), r2(n), moved1, moved2;
+            BArray<T> ltmp(n), ktmp(n), entmp(n), eetmp(n), unif(n);
+            T nuclear_nuclear = 1.0/(R1 - R2).norm();
+            Eigen::Array<bool, Eigen::Dynamic, 1> accepted(n);
+            std::vector<Eigen::Index> moved;
+            moved.reserve(n);
+            auto propose = [&](int e, BCoord<T>& r, T step) {
+                uniform_fill(gen64, r.x, -1.0, 1.0);
+                uniform_fill(gen64, r.y, -1.0, 1.0);
+                uniform_fill(gen64, r.z, -1.0, 1.0);
+                r.x = MapArray(pool.pos(e, 0) + begin, n) + step*r.x;
+                r.y = MapArray(pool.pos(e, 1) + begin, n) + step*r.y;
+                r.z = MapArray(pool.pos(e, 2) + begin, n) + step*r.z;
+            };
+            auto update = [&](int e, const BCoord<T>& r) {
+                MapArray x(pool.pos(e, 0) + begin, n), y(pool.pos(e, 1) + begin, n), z(pool.pos(e, 2) + begin, n);
+                x = accepted.select(r.x, x);
+                y = accepted.select(r.y, y);
+                z = accepted.select(r.z, z);
+            };
+            T step = dr;
+            for(int i=0; i<maxstep && n>0; i++) {
+                step = std::min(std::max(step, static_cast<T>(0.1)), static_cast<T>(10.0));
+                propose(0, r1, step);
+                propose(1, r2, step);
+                uniform_fill(gen64, unif, 0.0, 1.0);
+                mol->logpsi_batch(r1, r2, ltmp);
+                accepted = unif.log() < 2*(ltmp - logpsi);
+                update(0, r1);
+                update(1, r2);
+                logpsi = accepted.select(ltmp, logpsi);
+                // the local energies of the accepted moves only, packed
+                moved.clear();
+                for(Eigen::Index w=0; w<n; w++) {
+                    if(accepted(w)) moved.push_back(w);
+                }
+                moved1.gather(r1, moved);
+                moved2.gather(r2, moved);
+                mol->energy_components_batch(moved1, moved2, ktmp, entmp, eetmp);
+                for(size_t j=0; j<moved.size(); j++) {
+                    auto w = moved[j];
+                    kinetic(w) = ktmp(j);
+                    electron_nuclear(w) = entmp(j);
+                    electron_electron(w) = eetmp(j);
+                    eloc(w) = ktmp(j) + entmp(j) + eetmp(j) + nuclear_nuclear;
+                }
+                acc.accept += accepted.count();
+                auto esum = eloc.sum(), esq = eloc.square().sum();
+                acc.energy_tot += esum;
+                acc.energy_sq_tot += esq;
+                acc.count += n;
+                local_blocks[tid].add(esum, esq, n);
+                if(progress) progress[tid].add(esum, esq, n, accepted.count(), n, step);
+                if(static_cast<T>(acc.accept)/std::max(acc.count, 1L) > 0.5) step*=scale;
+                else step/=scale;
+                if((i + 1) % every == 0) {
+                    for(auto& est: local[tid]) {
+                        for(auto w=begin; w<end; w++) {
+                            auto e = components(pool, w);
+                            accumulate(est.get(), pool.position(w, 0), pool.position(w, 1), &e);
+                        }
+                    }
+                }
+            }
+            if(progress) progress[tid].finish();
+            accum[tid] = acc;
+        };
+        std::vector<std::thread> pool_threads;
+        for(int i=1; i<nthread; i++) pool_threads.emplace_back(worker, i);
+        worker(0);
+        for(auto& t: pool_threads) t.join();
+        for(auto& l: local) {
+            for(size_t j=0; j<estimators.size(); j++) estimators[j]->merge(*l[j]);
+        }
+        blocking.reset(block);
+        for(auto& b: local_blocks) blocking.merge(b);
+
+        T energy_tot = 0.0, energy_sq_tot = 0.0;
+        long accept = 0, count = 0;
+        for(int i=0; i<nthread; i++) {
+            energy_tot += accum[i].energy_tot;
+            energy_sq_tot += accum[i].energy_sq_tot;
+            accept += accum[i].accept;
+            count += accum[i].count;
+        }
+        accept_rate = static_cast<T>(accept)/count;
+        auto energy_avg = energy_tot/count;
+        auto energy_std = std::sqrt(energy_sq_tot/count - energy_avg*energy_avg);
+        if(verbose) fmt::print("Accept ratio: {}\n", accept_rate);
+        return {energy_avg, energy_std};
+    }
+
+    // Energy and forces on the nuclei, Hellmann-Feynman (zero-variance) + Pulay
+    // $$F_I = \langle F^{ZV}_I \rangle - 2 (\langle E_L \partial_I \ln\psi \rangle - 
+    //         \langle E_L \rangle \langle \partial_I \ln\psi \rangle)$$
+    // The errors are those of the per-sample estimator
+    // $$F^{ZV}_I - 2 (E_L - \bar{E}) \partial_I \ln\psi$$ over blocks of
+    // set_block() steps, maxstep/force_blocks steps if that is 0, so that they
+    // include the autocorrelation and the covariance of the two terms
+    H2Force<T> sample_force(int maxstep=10000) {
+        typedef Eigen::Matrix<T, 6, 1> Vec6;
+        typedef Eigen::Matrix<T, 6, Eigen::Dynamic> BlockSums;
+        T energy;
+        PCoord<T> f1, f2, dlog1, dlog2;
+        Vec6 f, d;
+        long size = block > 0 ? block : std::max(maxstep/force_blocks, 1);
+        long nblock = (maxstep + size - 1)/size;
+        // sums of F, dlog and E dlog in every block
+        BlockSums f_sum = BlockSums::Zero(6, nblock);
+        BlockSums d_sum = BlockSums::Zero(6, nblock);
+        BlockSums ed_sum = BlockSums::Zero(6, nblock);
+        T energy_tot = 0.0;
+        T energy_sq_tot = 0.0;
+        long step = 0;
+        H2Symmetry<T> sym(R1, R2);
+        auto progress = telemetry ? telemetry->begin(1, maxstep) : nullptr;
+        int moved = -1;
+        auto accept = walk(maxstep, 
+            [&](const PCoord<T>& r1, const PCoord<T>& r2) {
+                energy = mol->energy(r1, r2);
+                moved++;
+                mol->force(r1, r2, f1, f2, dlog1, dlog2);
+                if(symmetric) {
+                    sym.average(f1, f2);
+                    sym.average(dlog1, dlog2);
+                }
+                f << f1.transpose(), f2.transpose();
+                d << dlog1.transpose(), dlog2.transpose();
+            },
+            [&](const PCoord<T>&, const PCoord<T>&) {
+                auto b = step++/size;
+                energy_tot += energy;
+                energy_sq_tot += energy*energy;
+                f_sum.col(b) += f;
+                d_sum.col(b) += d;
+                ed_sum.col(b) += energy*d;
+                if(progress) progress->add(energy, energy*energy, 1, moved, 1, dr);
+                moved = 0;
+            });
+        if(progress) progress->finish();
+        if(verbose) fmt::print("Accept ratio: {}\n", (double) accept/maxstep);
+
+        H2Force<T> ret;
+        auto e = energy_tot/maxstep;
+        ret.energy = e;
+        ret.energy_std = std::sqrt(energy_sq_tot/maxstep - e*e);
+        // the blocks of the estimator about the mean energy of the run
+        BlockSums est = f_sum - 2*(ed_sum - e*d_sum);
+        Vec6 force = est.rowwise().sum()/maxstep;
+        Vec6 err = Vec6::Zero();
+        if(nblock > 1) {
+            Eigen::Matrix<T, 1, Eigen::Dynamic> steps(nblock);
+            for(long b=0; b<nblock; b++) steps(b) = std::min(size, maxstep - b*size);
+            Vec6 var = (est - force*steps).rowwise().squaredNorm()/(static_cast<T>(maxstep)*maxstep);
+            err = (var*nblock/(nblock - 1)).cwiseSqrt();
+        }
+        ret.force1 = force.template head<3>().transpose();
+        ret.force2 = force.template tail<3>().transpose();
+        ret.error1 = err.template head<3>().transpose();
+        ret.error2 = err.template tail<3>().transpose();
+        return ret;
+    }
+
+    // Steepest descent of the nuclei along the QMC forces, stops when the
+    // forces are below ftol or within two standard errors of zero
+    H2Force<T> optimize(int niter, int maxstep=10000, T step=0.5, T ftol=1e-3, T maxdisp=0.1) {
+        H2Force<T> ret;
+        if(verbose) fmt::print("{:>6s}\t{:>12s}\t{:>12s}\t{:>12s}\t{:>12s}\n", "Iter", "Bond length", "Energy", "Force", "Force Err");
+        for(int n=0; n<niter; n++) {
+            ret = sample_force(maxstep);
+            if(verbose) fmt::print("{:>6d}\t{:>12.6f}\t{:>12.6f}\t{:>12.6f}\t{:>12.6f}\n", n, (R1-R2).norm(),
+                       ret.energy, ret.force1.norm(), ret.error1.norm());
+            if(ret.force1.norm() < std::max(ftol, 2*ret.error1.norm())) break;
+            PCoord<T> d1 = step*ret.force1, d2 = step*ret.force2;
+            if(d1.norm() > maxdisp) d1 *= maxdisp/d1.norm();
+            if(d2.norm() > maxdisp) d2 *= maxdisp/d2.norm();
+            set_geometry(R1 + d1, R2 + d2);
+        }
+        return ret;
+    }
+
+private:
+    H2Mol<T, Jastrow, AtomicWfn>* mol;
+    JastrowParam<T> param;
+    T c, alpha;
+    PCoord<T> R1, R2;
+    T dr;
+    std::shared_ptr<const MoldenFile<T>> basis;
+    int orbital;
+    std::random_device rd;
+    std::mt19937 rgen{rd()};
+    std::uniform_real_distribution<T> rdist{-1.0, 1.0};
+    const T scale = 1.01;
+    bool verbose = true;
+    T accept_rate = 0.0;
+    long block = 0;
+    Blocking<T> blocking;
+    // blocks of the force errors when set_block() is 0
+    static const int force_blocks = 32;
+    bool symmetric = false;
+    Telemetry* telemetry = nullptr;
+
+    inline void accumulate(Estimator<Mol>* est, const PCoord<T>& r1, const PCoord<T>& r2,
+                           const EnergyComponents<T>* e=nullptr) {
+        if(symmetric) est->accumulate_images(*mol, r1, r2, e);
+        else est->accumulate(*mol, r1, r2, e);
+    }
+
+    // the components of the local energy cached in the walker pool
+    inline void set_components(WalkerPool<T>& pool, size_t w, const EnergyComponents<T>& e) {
+        pool.eloc(w) = e.total();
+        pool.component(0, w) = e.kinetic;
+        pool.component(1, w) = e.electron_nuclear;
+        pool.component(2, w) = e.electron_electron;
+    }
+
+    inline EnergyComponents<T> components(WalkerPool<T>& pool, size_t w) const {
+        return {pool.component(0, w), pool.component(1, w), pool.component(2, w), 1/(R1 - R2).norm()};
+    }
+
+    // uniform random coordinate in [-1, 1]^3
+    inline PCoord<T> random_coord() {
+        PCoord<T> ret;
+        ret << rdist(rgen), rdist(rgen), rdist(rgen);
+        return ret;
+    }
+
+    // Metropolis walk, update(r1, r2) is called for the initial and every
+    // accepted configuration, accumulate(r1, r2) after every step
+    template<typename Update, typename Accumulate>
+    int walk(int maxstep, Update update, Accumulate accumulate) {
+        PCoord<T> r1 = random_coord(); 
+        PCoord<T> r2 = random_coord();
+
+        PCoord<T> r1_new, r2_new;
+        update(r1, r2);
+        T logpsi = mol->logpsi(r1, r2);
+        std::uniform_real_distribution<T> rnum(0, 1);
+
         int accept = 0;
         for(int i=0; i<maxstep; i++) {
 
             dr = std::max(dr, 0.1);
             dr = std::min(dr, 10.0);
 
-            r1_new = r1 + dr*PCoord<T>::Random();
-            r2_new = r2 + dr*PCoord<T>::Random();
+            r1_new = r1 + dr*random_coord();
+            r2_new = r2 + dr*random_coord();
 
-            auto dtmp = mol->density(r1_new, r2_new);
-            auto ratio = dtmp/density;
-            
-            if(ratio > 1 || ratio > rnum(rgen)) {
+            // |psi_new/psi_old|^2 > u in the log domain, no under/overflow
+            auto ltmp = mol->logpsi(r1_new, r2_new);
+            if(std::log(rnum(rgen)) < 2*(ltmp - logpsi)) {
                 r1 = r1_new;
                 r2 = r2_new;
-                density = dtmp;
-                energy = mol->energy(r1, r2);
+                logpsi = ltmp;
+                update(r1, r2);
                 accept += 1;
             }
 
             if(static_cast<T>(accept)/(i+1) > 0.5) dr*=scale;
             else dr/=scale;
 
-            energy_tot += energy;
-            energy_sq_tot += energy*energy;
+            accumulate(r1, r2);
         }
-        auto energy_avg = energy_tot/maxstep;
-        auto energy_std = std::sqrt(energy_sq_tot/maxstep - energy_avg*energy_avg);
-        fmt::print("Accept ratio: {}\n", (double) accept/maxstep);
-        return {energy_avg, energy_std};
+        accept_rate = static_cast<T>(accept)/maxstep;
+        return accept;
     }
-
-private:
-    H2Mol<T, JastrowType::SIMPLE_JASTROW, AtomicWfnType::MO>* mol;
-    PCoord<T> R1, R2;
-    T dr;
-    std::random_device rd;
-    std::mt19937 rgen{rd()};
-    const T scale = 1.01;
-    // T c, alpha;
 };
\ No newline at end of file
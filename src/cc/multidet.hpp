@@ -0,0 +1,317 @@
+#pragma once
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <Eigen/Dense>
+#include "hydrogen.hpp"
+
+// One term of a CI expansion, c_I D_up(occ_up) D_dn(occ_dn), the
+// occupations are indices into the orbital set shared by both spins
+template<typename T>
+struct CIDeterminant {
+    T coef;
+    std::vector<int> up, dn;
+};
+
+// Multi-Slater-determinant wave function
+// $$\psi = \sum_I c_I D^\uparrow_I D^\downarrow_I = D^\uparrow_0 D^\downarrow_0 \sum_I c_I R^\uparrow_I R^\downarrow_I$$
+// evaluated with the table method. Every spin keeps the inverse of the
+// reference matrix $$A_{ij} = \phi_{ref_j}(\mathbf{r_i})$$ (the first determinant)
+// and the table $$T = A^{-1}\Phi$$ over all orbitals. The ratio of an excited
+// determinant to the reference is the determinant of the k x k block of T with
+// the rows of the holes and the columns of the particles. The unique
+// determinants of each spin are stored once, so moving an up electron costs
+// O(n norb) for the table, O(n_up k^3) for the ratios and O(n_up) for the sum,
+// with the down ratios folded into per-up-determinant coefficients. Those are
+// summed over the CI list only when the moving spin changes. Every determinant
+// is linear in the row of an electron, so its gradient and Laplacian are the
+// determinants with that row replaced by the derivatives of the orbitals,
+// the same rank one update of the table as a move.
+template<typename T>
+class MultiSlaterDet {
+public:
+    typedef Eigen::Matrix<T, Eigen::Dynamic, 1> Vector;
+    typedef Eigen::Matrix<T, 1, Eigen::Dynamic> RowVector;
+    typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+    // the orbitals are not owned, the first determinant is the reference
+    MultiSlaterDet(const std::vector<WaveFn<T>*>& orbitals, int nup, int ndn,
+                   const std::vector<CIDeterminant<T>>& dets):
+        orbitals(orbitals), phi_new(orbitals.size()) {
+        if(dets.empty()) throw std::runtime_error("Empty CI expansion");
+        sector[0].init(dets[0].up, nup, orbitals.size());
+        sector[1].init(dets[0].dn, ndn, orbitals.size());
+        for(auto& det: dets) {
+            int iu, id;
+            T su, sd;
+            std::tie(iu, su) = sector[0].add(det.up);
+            std::tie(id, sd) = sector[1].add(det.dn);
+            coef.push_back(det.coef*su*sd);
+            index[0].push_back(iu);
+            index[1].push_back(id);
+        }
+        for(int s=0; s<2; s++) {
+            sector[s].ratio.setZero(sector[s].excitations.size());
+            partial[s].setZero(sector[s].excitations.size());
+        }
+    }
+
+    int electrons() const {
+        return sector[0].nelec + sector[1].nelec;
+    }
+
+    // number of unique determinants of spin s (0 up, 1 down)
+    size_t unique(int s) const {
+        return sector[s].excitations.size();
+    }
+
+    size_t size() const {
+        return coef.size();
+    }
+
+    // Set the electrons (up first, then down) and build the tables from scratch,
+    // also used to remove the round-off accumulated by the updates
+    T evaluate(const std::vector<PCoord<T>>& coords) {
+        if(static_cast<int>(coords.size()) != electrons()) {
+            throw std::runtime_error("Expect " + std::to_string(electrons()) + " electrons");
+        }
+        positions = coords;
+        for(int s=0; s<2; s++) {
+            auto& sec = sector[s];
+            for(int i=0; i<sec.nelec; i++) {
+                orbital_values(coords[s*sector[0].nelec + i], phi_new);
+                sec.phi.row(i) = phi_new.transpose();
+            }
+            Matrix A(sec.nelec, sec.nelec);
+            for(int j=0; j<sec.nelec; j++) A.col(j) = sec.phi.col(sec.ref[j]);
+            Eigen::PartialPivLU<Matrix> lu(A);
+            sec.det = lu.determinant();
+            sec.inv = lu.inverse();
+            sec.table = sec.inv*sec.phi;
+            sec.ratios(sec.table, sec.ratio);
+        }
+        contract(0);
+        contract(1);
+        sum = sector[0].ratio.dot(partial[0]);
+        return value();
+    }
+
+    T value() const {
+        return sector[0].det*sector[1].det*sum;
+    }
+
+    // psi(r_e -> r_new)/psi, the move is kept until accept() or the next ratio()
+    T ratio(int e, const PCoord<T>& r_new) {
+        spin = e < sector[0].nelec ? 0 : 1;
+        elec = e - spin*sector[0].nelec;
+        if(stale[spin]) contract(spin);
+        auto& sec = sector[spin];
+        r_move = r_new;
+        orbital_values(r_new, phi_new);
+        // rank one update of the table, row elec of A and Phi change by da, dphi
+        // $$T' = T + \frac{A^{-1}e_i}{\rho}(\delta\phi^T - \delta a^T T)$$
+        RowVector dphi = phi_new.transpose() - sec.phi.row(elec);
+        RowVector da(sec.nelec);
+        for(int j=0; j<sec.nelec; j++) da(j) = dphi(sec.ref[j]);
+        ref_ratio = 1 + da.dot(sec.inv.col(elec));
+        inv_col = sec.inv.col(elec)/ref_ratio;
+        table_new = sec.table + inv_col*(dphi - da*sec.table);
+        sec.ratios(table_new, ratio_new);
+        sum_new = ratio_new.dot(partial[spin]);
+        return ref_ratio*sum_new/sum;
+    }
+
+    // accept the last move of ratio()
+    void accept() {
+        auto& sec = sector[spin];
+        RowVector da(sec.nelec);
+        for(int j=0; j<sec.nelec; j++) da(j) = phi_new(sec.ref[j]) - sec.phi(elec, sec.ref[j]);
+        // Sherman-Morrison, $$A'^{-1} = A^{-1} - \frac{A^{-1}e_i \delta a^T A^{-1}}{\rho}$$
+        RowVector dainv = da*sec.inv;
+        sec.inv -= inv_col*dainv;
+        sec.phi.row(elec) = phi_new.transpose();
+        sec.table.swap(table_new);
+        sec.ratio.swap(ratio_new);
+        sec.det *= ref_ratio;
+        sum = sum_new;
+        positions[spin*sector[0].nelec + elec] = r_move;
+        // the other spin sums over the ratios of this one, it is contracted
+        // again at its next move, i.e. twice per sweep of all the electrons
+        stale[1 - spin] = true;
+    }
+
+    // $$\nabla_e \psi/\psi$$ and $$\nabla^2_e \psi/\psi$$ at the current positions
+    void derivs(int e, PCoord<T>& grad, T& lap) {
+        int s = e < sector[0].nelec ? 0 : 1;
+        int i = e - s*sector[0].nelec;
+        if(stale[s]) contract(s);
+        auto& r = positions[e];
+        Vector gx(orbitals.size()), gy(orbitals.size()), gz(orbitals.size()), l(orbitals.size());
+        for(size_t j=0; j<orbitals.size(); j++) {
+            auto g = orbitals[j]->grad(r);
+            gx(j) = g(0);
+            gy(j) = g(1);
+            gz(j) = g(2);
+            l(j) = orbitals[j]->laplace(r);
+        }
+        grad << replaced(s, i, gx), replaced(s, i, gy), replaced(s, i, gz);
+        lap = replaced(s, i, l);
+    }
+
+private:
+    // Excitation of a determinant w.r.t. the reference, holes are the slots of
+    // the reference replaced by the orbitals parts in the same order
+    struct Excitation {
+        std::vector<int> holes, parts;
+    };
+
+    struct Sector {
+        int nelec;
+        std::vector<int> ref;
+        std::vector<Excitation> excitations;
+        std::vector<std::vector<int>> occupations;
+        Matrix phi, inv, table;
+        Vector ratio;
+        T det;
+
+        void init(const std::vector<int>& occ, int n, size_t norb) {
+            if(static_cast<int>(occ.size()) != n) throw std::runtime_error("Invalid number of electrons");
+            nelec = n;
+            ref = occ;
+            phi.resize(n, norb);
+        }
+
+        // index of the unique determinant and the sign of occ w.r.t. it
+        std::pair<int, T> add(const std::vector<int>& occ) {
+            if(static_cast<int>(occ.size()) != nelec) throw std::runtime_error("Invalid number of electrons");
+            Excitation ex;
+            for(int j=0; j<nelec; j++) {
+                if(std::find(occ.begin(), occ.end(), ref[j]) == occ.end()) ex.holes.push_back(j);
+            }
+            for(auto o: occ) {
+                if(std::find(ref.begin(), ref.end(), o) == ref.end()) ex.parts.push_back(o);
+            }
+            // the determinant of the table block is the one of the reference
+            // with the holes replaced in place, permute it to occ
+            auto inplace = ref;
+            for(size_t k=0; k<ex.holes.size(); k++) inplace[ex.holes[k]] = ex.parts[k];
+            int ninv = 0;
+            for(int a=0; a<nelec; a++) {
+                for(int b=a+1; b<nelec; b++) {
+                    auto pa = std::find(inplace.begin(), inplace.end(), occ[a]) - inplace.begin();
+                    auto pb = std::find(inplace.begin(), inplace.end(), occ[b]) - inplace.begin();
+                    if(pa > pb) ninv++;
+                }
+            }
+            T sign = ninv % 2 ? -1 : 1;
+            std::sort(inplace.begin(), inplace.end());
+            auto it = std::find(occupations.begin(), occupations.end(), inplace);
+            if(it != occupations.end()) {
+                // same set of orbitals, fix the sign w.r.t. the stored order
+                auto idx = it - occupations.begin();
+                return {static_cast<int>(idx), sign*parity(excitations[idx], ex)};
+            }
+            occupations.push_back(inplace);
+            excitations.push_back(ex);
+            return {static_cast<int>(excitations.size()) - 1, sign};
+        }
+
+        // relative sign of two pairings of the same holes and particles
+        T parity(const Excitation& stored, const Excitation& ex) const {
+            std::vector<int> a = ref, b = ref;
+            for(size_t k=0; k<stored.holes.size(); k++) a[stored.holes[k]] = stored.parts[k];
+            for(size_t k=0; k<ex.holes.size(); k++) b[ex.holes[k]] = ex.parts[k];
+            int ninv = 0;
+            for(int i=0; i<nelec; i++) {
+                for(int j=i+1; j<nelec; j++) {
+                    auto pi = std::find(a.begin(), a.end(), b[i]) - a.begin();
+                    auto pj = std::find(a.begin(), a.end(), b[j]) - a.begin();
+                    if(pi > pj) ninv++;
+                }
+            }
+            return ninv % 2 ? -1 : 1;
+        }
+
+        // ratios of all the unique determinants to the reference from the table
+        void ratios(const Matrix& tab, Vector& out) const {
+            out.resize(excitations.size());
+            for(size_t I=0; I<excitations.size(); I++) {
+                auto& h = excitations[I].holes;
+                auto& p = excitations[I].parts;
+                switch(h.size()) {
+                    case 0:
+                        out(I) = 1;
+                        break;
+                    case 1:
+                        out(I) = tab(h[0], p[0]);
+                        break;
+                    case 2:
+                        out(I) = tab(h[0], p[0])*tab(h[1], p[1]) - tab(h[0], p[1])*tab(h[1], p[0]);
+                        break;
+                    default: {
+                        Matrix block(h.size(), h.size());
+                        for(size_t a=0; a<h.size(); a++) {
+                            for(size_t b=0; b<h.size(); b++) block(a, b) = tab(h[a], p[b]);
+                        }
+                        out(I) = block.determinant();
+                        break;
+                    }
+                }
+            }
+        }
+    };
+
+    std::vector<WaveFn<T>*> orbitals;
+    Sector sector[2];
+    std::vector<T> coef;
+    std::vector<int> index[2];
+    // partial[s](I) sums c R of the other spin over the CI terms with the
+    // unique determinant I of spin s
+    Vector partial[2];
+    bool stale[2] = {false, false};
+    T sum = 0.0;
+
+    std::vector<PCoord<T>> positions;
+
+    // the pending move
+    int spin = 0, elec = 0;
+    PCoord<T> r_move;
+    T ref_ratio = 1.0, sum_new = 0.0;
+    Vector phi_new, inv_col, ratio_new;
+    Matrix table_new;
+    // scratch of derivs()
+    Vector ratio_der;
+    Matrix table_der;
+
+    void orbital_values(const PCoord<T>& r, Vector& out) {
+        for(size_t j=0; j<orbitals.size(); j++) out(j) = orbitals[j]->value(r);
+    }
+
+    // psi with the row i of spin s replaced by h, over psi. With the reference
+    // ratio $$\rho = h_{ref} \cdot A^{-1}e_i$$ and $$v = h^T - h_{ref}^T T$$ the table
+    // is $$T + A^{-1}e_i v/\rho$$. A block determinant is affine in the rank one
+    // term (matrix determinant lemma), so $$\rho R_I(h) = \rho R_I + R_I(T + A^{-1}e_i v) - R_I$$,
+    // without dividing by rho, which vanishes where ln D_ref is stationary
+    T replaced(int s, int i, const Vector& h) {
+        auto& sec = sector[s];
+        RowVector href(sec.nelec);
+        for(int j=0; j<sec.nelec; j++) href(j) = h(sec.ref[j]);
+        T rho = href.dot(sec.inv.col(i));
+        table_der = sec.table + sec.inv.col(i)*(h.transpose() - href*sec.table);
+        sec.ratios(table_der, ratio_der);
+        ratio_der += (rho - 1)*sec.ratio;
+        return ratio_der.dot(partial[s])/sum;
+    }
+
+    void contract(int s) {
+        auto& other = sector[1 - s].ratio;
+        partial[s].setZero();
+        for(size_t I=0; I<coef.size(); I++) {
+            partial[s](index[s][I]) += coef[I]*other(index[1 - s][I]);
+        }
+        stale[s] = false;
+    }
+};
@@ -0,0 +1,317 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fmt/core.h>
+
+// Sums of the local energy over `steps` consecutive steps of a sampler,
+// count samples in total (one per walker and step)
+template<typename T>
+struct Block {
+    long steps;
+    T count, sum, sum_sq;
+};
+
+// Appends the samples of every step to blocks of `size` steps, one block for
+// the whole run for size <= 0. The samplers keep one and hand out the blocks
+// of their last run
+template<typename T>
+class Blocking {
+public:
+    void reset(long n) {
+        size = n;
+        data.clear();
+    }
+
+    inline void add(T sum, T sum_sq, T count) {
+        if(data.empty() || (size > 0 && data.back().steps == size)) data.push_back({0, 0, 0, 0});
+        auto& b = data.back();
+        b.steps++;
+        b.count += count;
+        b.sum += sum;
+        b.sum_sq += sum_sq;
+    }
+
+    // add the samples of the same steps of another walker set, block by block
+    void merge(const Blocking& other) {
+        if(data.size() < other.data.size()) data.resize(other.data.size(), {0, 0, 0, 0});
+        for(size_t i=0; i<other.data.size(); i++) {
+            data[i].steps = other.data[i].steps;
+            data[i].count += other.data[i].count;
+            data[i].sum += other.data[i].sum;
+            data[i].sum_sq += other.data[i].sum_sq;
+        }
+    }
+
+    const std::vector<Block<T>>& blocks() const {
+        return data;
+    }
+
+private:
+    long size = 0;
+    std::vector<Block<T>> data;
+};
+
+template<typename T>
+struct BlockSummary {
+    long steps;
+    T mean, std, error;
+};
+
+// Mean, std of the samples and the standard error of the mean from the
+// spread of the block means, over the first blocks covering maxstep steps
+// (all for maxstep < 0). Blocks of unequal weight c_b enter as
+// $$\sigma^2 = \frac{n_b}{n_b - 1}\sum_b \frac{c_b^2 (m_b - m)^2}{C^2}$$
+template<typename T>
+BlockSummary<T> summarize(const std::vector<Block<T>>& blocks, long maxstep=-1) {
+    BlockSummary<T> ret = {0, 0, 0, 0};
+    T count = 0, sum = 0, sum_sq = 0;
+    size_t nblock = 0;
+    for(; nblock<blocks.size() && (maxstep < 0 || ret.steps < maxstep); nblock++) {
+        ret.steps += blocks[nblock].steps;
+        count += blocks[nblock].count;
+        sum += blocks[nblock].sum;
+        sum_sq += blocks[nblock].sum_sq;
+    }
+    if(count == 0) return ret;
+    ret.mean = sum/count;
+    ret.std = std::sqrt(std::max(sum_sq/count - ret.mean*ret.mean, static_cast<T>(0)));
+    if(nblock < 2) return ret;
+    T var = 0;
+    for(size_t b=0; b<nblock; b++) {
+        auto d = blocks[b].sum - blocks[b].count*ret.mean;
+        var += d*d;
+    }
+    ret.error = std::sqrt(var/(count*count)*nblock/(nblock - 1));
+    return ret;
+}
+
+// Identity of a cached point: executable, system, the parameters of the
+// wave function and the sampler and the seed. Doubles are kept in hex, so
+// that equal parameters give equal keys exactly
+class CacheKey {
+public:
+    CacheKey(const std::string& exe, const std::string& system, unsigned seed):
+        seed(seed), text(fmt::format("exe={};system={};seed={}", exe, system, seed)) {}
+
+    CacheKey& add(const std::string& name, double val) {
+        text += fmt::format(";{}={:a}", name, val);
+        return *this;
+    }
+
+    CacheKey& add(const std::string& name, const std::string& val) {
+        text += fmt::format(";{}={}", name, val);
+        return *this;
+    }
+
+    const std::string& str() const {
+        return text;
+    }
+
+    // FNV-1a
+    uint64_t hash() const {
+        uint64_t h = 14695981039346656037ULL;
+        for(unsigned char ch: text) {
+            h ^= ch;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    unsigned seed;
+
+private:
+    std::string text;
+};
+
+// On-disk store of sampled points, an append-only file of records
+//     header | key (padded to 8 bytes) | blocks
+// A newer record of a key supersedes the older ones. The file is mapped
+// read-only and indexed by the key hash once, lookups then read the record
+// in place. Appends hold an exclusive flock, so several programs can share
+// one cache. A record torn by a crash ends the scan and is cut off by the
+// next append.
+class ResultCache {
+public:
+    ResultCache(const std::string& path): path(path) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if(fd < 0) throw std::runtime_error("Cannot open the cache " + path);
+        uint64_t tag = file_magic;
+        flock(fd, LOCK_EX);
+        struct stat st;
+        fstat(fd, &st);
+        if(st.st_size == 0 && ::write(fd, &tag, sizeof(tag)) != sizeof(tag)) {
+            flock(fd, LOCK_UN);
+            close(fd);
+            throw std::runtime_error("Cannot write the cache " + path);
+        }
+        flock(fd, LOCK_UN);
+        refresh();
+        if(mapped < sizeof(file_magic) || std::memcmp(base, &tag, sizeof(tag)) != 0) {
+            unmap();
+            close(fd);
+            throw std::runtime_error(path + " is not a result cache");
+        }
+    }
+
+    ~ResultCache() {
+        unmap();
+        close(fd);
+    }
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // number of distinct keys
+    size_t size() const {
+        return index.size();
+    }
+
+    // the stored blocks of key, false if there are none
+    bool lookup(const CacheKey& key, std::vector<Block<double>>& blocks) {
+        refresh();
+        auto it = index.find(key.hash());
+        if(it == index.end()) return false;
+        auto head = reinterpret_cast<const Header*>(base + it->second);
+        auto text = base + it->second + sizeof(Header);
+        // a 64-bit hash collision counts as a miss
+        if(key.str() != std::string(text, head->key_size)) return false;
+        auto data = reinterpret_cast<const StoredBlock*>(text + padded(head->key_size));
+        blocks.resize(head->nblock);
+        for(uint32_t b=0; b<head->nblock; b++) {
+            blocks[b] = {static_cast<long>(data[b].steps), data[b].count, data[b].sum, data[b].sum_sq};
+        }
+        return true;
+    }
+
+    void store(const CacheKey& key, const std::vector<Block<double>>& blocks) {
+        auto summary = summarize(blocks);
+        Header head = {record_magic, key.hash(), static_cast<uint32_t>(key.str().size()),
+                       static_cast<uint32_t>(blocks.size()), summary.steps, summary.mean,
+                       summary.std, summary.error};
+        std::vector<char> buffer(sizeof(Header) + padded(head.key_size) + blocks.size()*sizeof(StoredBlock), 0);
+        std::memcpy(buffer.data(), &head, sizeof(Header));
+        std::memcpy(buffer.data() + sizeof(Header), key.str().data(), head.key_size);
+        auto data = reinterpret_cast<StoredBlock*>(buffer.data() + sizeof(Header) + padded(head.key_size));
+        for(size_t b=0; b<blocks.size(); b++) {
+            data[b] = {blocks[b].steps, blocks[b].count, blocks[b].sum, blocks[b].sum_sq};
+        }
+        flock(fd, LOCK_EX);
+        // the records of the other writers, then drop a torn tail
+        refresh();
+        struct stat st;
+        fstat(fd, &st);
+        if(static_cast<size_t>(st.st_size) > scanned && ftruncate(fd, scanned) != 0) {
+            flock(fd, LOCK_UN);
+            throw std::runtime_error("Cannot truncate the cache " + path);
+        }
+        auto written = pwrite(fd, buffer.data(), buffer.size(), scanned);
+        flock(fd, LOCK_UN);
+        if(written != static_cast<ssize_t>(buffer.size())) throw std::runtime_error("Cannot write the cache " + path);
+        refresh();
+    }
+
+private:
+    static const uint64_t file_magic = 0x31484341434d4351ULL; // "QMCCACH1"
+    static const uint64_t record_magic = 0x5245434f52444d51ULL; // "QMDROCER"
+
+    struct Header {
+        uint64_t magic;
+        uint64_t hash;
+        uint32_t key_size;
+        uint32_t nblock;
+        int64_t steps;
+        double mean, std, error;
+    };
+
+    struct StoredBlock {
+        int64_t steps;
+        double count, sum, sum_sq;
+    };
+
+    std::string path;
+    int fd = -1;
+    const char* base = nullptr;
+    size_t mapped = 0;
+    // the end of the last complete record, the latest record of every key hash
+    size_t scanned = sizeof(file_magic);
+    std::unordered_map<uint64_t, size_t> index;
+
+    static size_t padded(size_t n) {
+        return (n + 7)/8*8;
+    }
+
+    void unmap() {
+        if(base) munmap(const_cast<char*>(base), mapped);
+        base = nullptr;
+        mapped = 0;
+    }
+
+    // map the records appended since the last call and index them
+    void refresh() {
+        struct stat st;
+        fstat(fd, &st);
+        auto size = static_cast<size_t>(st.st_size);
+        if(size == mapped) return;
+        unmap();
+        auto ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if(ptr == MAP_FAILED) throw std::runtime_error("Cannot map the cache " + path);
+        base = static_cast<const char*>(ptr);
+        mapped = size;
+        while(scanned + sizeof(Header) <= mapped) {
+            auto head = reinterpret_cast<const Header*>(base + scanned);
+            if(head->magic != record_magic) break;
+            auto end = scanned + sizeof(Header) + padded(head->key_size) + head->nblock*sizeof(StoredBlock);
+            if(end > mapped) break;
+            index[head->hash] = scanned;
+            scanned = end;
+        }
+    }
+};
+
+// Sample the point of key for nstep steps through the cache. run(nstep, seed)
+// returns the blocks of a new chain. The stored blocks are used up to the
+// last whole block within nstep steps: if they cover exactly nstep steps the
+// point is read back (hit), else they are extended by a chain of the missing
+// steps, whose seed derives from the key seed and the steps used. The record
+// is only replaced by a longer one. Without a cache it only runs. status is
+// "new", "hit" or "extended". The key has to hold the block size, the blocks
+// of one record all have the same size
+template<typename Run>
+BlockSummary<double> cached_run(ResultCache* cache, const CacheKey& key, long nstep, Run run,
+                                std::string& status) {
+    std::vector<Block<double>> blocks;
+    long used = 0, stored = 0;
+    if(cache && cache->lookup(key, blocks)) {
+        size_t n = 0;
+        for(auto& b: blocks) stored += b.steps;
+        for(; n<blocks.size() && used + blocks[n].steps <= nstep; n++) used += blocks[n].steps;
+        blocks.resize(n);
+        if(used == nstep) {
+            status = "hit";
+            return summarize(blocks);
+        }
+    }
+    status = used > 0 ? "extended" : "new";
+    auto seed = key.seed;
+    if(used > 0) {
+        std::seed_seq seq {key.seed, static_cast<unsigned>(used), static_cast<unsigned>(used >> 32)};
+        seq.generate(&seed, &seed + 1);
+    }
+    auto more = run(nstep - used, seed);
+    blocks.insert(blocks.end(), more.begin(), more.end());
+    auto ret = summarize(blocks);
+    if(cache && ret.steps > stored) cache->store(key, blocks);
+    return ret;
+}
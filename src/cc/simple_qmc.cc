@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <functional>
+#include <memory>
 #include <fmt/core.h>
 #include <cxxopts.hpp>
 #include "simple_qmc.hpp"
@@ -22,6 +24,16 @@ int main(int argc, char** argv) {
         ("alpha", "Trial wave function parameter alpha", cxxopts::value<double>()->default_value("1.0"))
         ("s,step", "Monte Carlo step size", cxxopts::value<double>()->default_value("1.0"))
         ("n,nstep", "Monte Carlo step size", cxxopts::value<int>()->default_value("1000000"))
+        ("w,walkers", "Number of walkers moved in lockstep", cxxopts::value<int>()->default_value("1"))
+        ("cache", "Result cache file, known points are read back or extended", cxxopts::value<std::string>()->default_value(""))
+        ("seed", "Random seed, always fixed with --cache", cxxopts::value<unsigned>()->default_value("1"))
+        ("block", "Steps per block of the error estimate, 0 for one block and no error", cxxopts::value<long>()->default_value("1000"))
+        ("metrics", "Rewrite this file with the live progress in the Prometheus text format",
+         cxxopts::value<std::string>()->default_value(""))
+        ("metrics-socket", "Serve the live progress on this Unix-domain socket",
+         cxxopts::value<std::string>()->default_value(""))
+        ("metrics-interval", "Seconds between the rewrites of the metrics file",
+         cxxopts::value<double>()->default_value("5"))
         ("h,help", "Print usage")
         ("cmin", "Minimum parameter c", cxxopts::value<double>())
         ("cmax", "Maximum parameter c", cxxopts::value<double>())
@@ -54,38 +66,68 @@ int main(int argc, char** argv) {
 
     fmt::print(banner);
     fmt::print("Simple Quantum Monte Carlo Program\n");
+    double dr = result["step"].as<double>();
+    int nstep = result["nstep"].as<int>();
+    int nwalker = result["walkers"].as<int>();
+    auto seed = result["seed"].as<unsigned>();
+    auto block = result["block"].as<long>();
+    std::unique_ptr<ResultCache> cache;
+    auto cache_path = result["cache"].as<std::string>();
+    if(!cache_path.empty()) cache.reset(new ResultCache(cache_path));
+    bool seeded = result.count("seed") || cache;
+    // live progress for the schedulers
+    std::unique_ptr<Telemetry> telemetry;
+    auto metrics_path = result["metrics"].as<std::string>();
+    auto metrics_socket = result["metrics-socket"].as<std::string>();
+    if(!metrics_path.empty() || !metrics_socket.empty()) {
+        telemetry.reset(new Telemetry("simple_qmc"));
+        telemetry->serve(metrics_path, metrics_socket, result["metrics-interval"].as<double>());
+    }
+
+    // one point, read back or extended when it is in the cache
+    auto run_point = [&](double c, double alpha) {
+        CacheKey key("simple_qmc", "hydrogen", seed);
+        key.add("c", c).add("alpha", alpha).add("step", dr).add("walkers", nwalker)
+           .add("block", std::max(block, 0L));
+        std::string status;
+        auto ret = cached_run(cache.get(), key, nwalker > 1 ? nstep/nwalker : nstep,
+            [&](long n, unsigned s) -> std::vector<Block<double>> {
+                NaiveQMC<double> sampler(c, alpha, dr);
+                if(seeded) sampler.seed(s);
+                sampler.set_block(block);
+                sampler.set_telemetry(telemetry.get());
+                if(nwalker > 1) sampler.sample_batch(nwalker, n);
+                else sampler.sample(n);
+                return sampler.blocks();
+            }, status);
+        fmt::print("{:>20.6f}\t{:>20.6f}\t{:>20.6f}\t{:>20.6f}\t{:>20.6f}", c, alpha, ret.mean, ret.std, ret.error);
+        if(cache) fmt::print("\t{:>20s}", status);
+        fmt::print("\n");
+    };
+    auto header = [&]() {
+        fmt::print("{:>20s}\t{:>20s}\t{:>20s}\t{:>20s}\t{:>20s}", "c", "alpha", "mean", "std", "error");
+        if(cache) fmt::print("\t{:>20s}", "cache");
+        fmt::print("\n");
+    };
+
     if(result["range"].as<bool>()) {
         fmt::print("Start range exploration...\n");
-        fmt::print("{:>20s}\t{:>20s}\t{:>20s}\t{:>20s}\n", "c", "alpha", "mean", "std");
+        header();
         auto cmin = result["cmin"].as<double>();
         auto cmax = result["cmax"].as<double>();
         auto ngridc = result["ngridc"].as<int>();
         auto alphamin = result["alphamin"].as<double>();
         auto alphamax = result["alphamax"].as<double>();
         auto ngridalpha = result["ngridalpha"].as<int>();
-        double dr = result["step"].as<double>();
-        int nstep = result["nstep"].as<int>();
 
         for(auto c: linspace(cmin, cmax, ngridc)) {
-            for(auto alpha: linspace(alphamin, alphamax, ngridalpha)) {
-                NaiveQMC<double> sampler(c, alpha, dr);
-                double mean, std;
-                std::tie(mean, std) = sampler.sample(nstep);
-                fmt::print("{:>20.6f}\t{:>20.6f}\t{:>20.6f}\t{:>20.6f}\n", c, alpha, mean, std);
-            }
+            for(auto alpha: linspace(alphamin, alphamax, ngridalpha)) run_point(c, alpha);
         }
 
     } else {
         fmt::print("Single point calculation...\n");
-        fmt::print("{:>20s}\t{:>20s}\t{:>20s}\t{:>20s}\n", "c", "alpha", "mean", "std");
-        double c = result["c"].as<double>();
-        double alpha = result["alpha"].as<double>();
-        double dr = result["step"].as<double>();
-        int nstep = result["nstep"].as<int>();
-        NaiveQMC<double> sampler(c, alpha, dr);
-        double mean, std;
-        std::tie(mean, std) = sampler.sample(nstep);
-        fmt::print("{:>20.6f}\t{:>20.6f}\t{:>20.6f}\t{:>20.6f}\n", c, alpha, mean, std);
+        header();
+        run_point(result["c"].as<double>(), result["alpha"].as<double>());
     }
 
     return 0;
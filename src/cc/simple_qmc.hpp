@@ -2,11 +2,17 @@
 #include <cmath>
 #include <random>
 #include <fmt/core.h>
+#include <Eigen/Dense>
+#include "result_cache.hpp"
+#include "telemetry.hpp"
+#include "walker.hpp"
 
 template <typename T>
 class NaiveQMC {
 
 public:
+    typedef Eigen::Array<T, Eigen::Dynamic, 1> Array;
+
     NaiveQMC(T c, T alpha, T dr): c(c), alpha(alpha), dr(dr) {}
 
     // return rho1 / rho2
@@ -15,11 +21,49 @@ public:
         return std::pow(ratio, 2)*std::exp(2*alpha*(r2-r1));
     }
 
+    // ln psi = ln(1 + cr) - alpha r, the acceptance test uses the difference
+    // of it instead of rho_ratio(), no pow/exp per step
+    T inline logpsi(T r) {
+        return std::log1p(c*r) - alpha*r;
+    }
+
     T inline energy_func(T r) {
         return (-c*(r*(alpha*(alpha*r-4)+2)+2)+
             alpha*(2-alpha*r)-2)/(2*r*(c*r+1));
     }
 
+    // logpsi() and energy_func() of a block of walkers, vectorized by Eigen
+    Array logpsi(const Array& r) {
+        return (c*r).log1p() - alpha*r;
+    }
+
+    Array energy_func(const Array& r) {
+        return (-c*(r*(alpha*(alpha*r - 4) + 2) + 2) +
+            alpha*(2 - alpha*r) - 2)/(2*r*(c*r + 1));
+    }
+
+    void seed(unsigned s) {
+        rgen.seed(s);
+    }
+
+    T accept_ratio() const {
+        return accept_rate;
+    }
+
+    // keep the energies of the next runs in blocks of nstep steps, 0 for one block per run
+    void set_block(long nstep) {
+        block = nstep;
+    }
+
+    const std::vector<Block<T>>& blocks() const {
+        return blocking.blocks();
+    }
+
+    // publish the progress of the next runs to telemetry, nullptr for none
+    void set_telemetry(Telemetry* t) {
+        telemetry = t;
+    }
+
     std::pair<T, T> sample(int maxstep=10000) {
         std::uniform_real_distribution<T> dist(-1.0, 1.0);
         std::uniform_real_distribution<T> rnum(0, 1);
@@ -28,11 +72,14 @@ public:
         T xold=0.5, yold=0.5, zold=0.5;
         rold = std::sqrt(xold*xold+yold*yold+zold*zold);
         T energy = energy_func(rold);
+        T lold = logpsi(rold);
         // fmt::print("{:f}\n",rold);
         // exit(0);
         T etot = 0;
         T etot_sq = 0;
         int accept = 0;
+        blocking.reset(block);
+        auto progress = telemetry ? telemetry->begin(1, maxstep) : nullptr;
         for(int i=0; i<maxstep; i++) {
 
             dr = std::max(dr, 0.1);
@@ -43,10 +90,12 @@ public:
             znew = zold + dr*dist(rgen);
             rnew = std::sqrt(xnew*xnew+ynew*ynew+znew*znew);
 
-            auto ratio = rho_ratio(rnew, rold);
-            if(ratio > 1 || ratio > rnum(rgen)) {
+            auto lnew = logpsi(rnew);
+            bool moved = std::log(rnum(rgen)) < 2*(lnew - lold);
+            if(moved) {
                 xold = xnew; yold = ynew; zold=znew;
                 rold = rnew;
+                lold = lnew;
                 energy = energy_func(rold);
                 accept++;
             }
@@ -56,7 +105,11 @@ public:
 
             etot += energy;
             etot_sq += std::pow(energy, 2);
+            blocking.add(energy, energy*energy, 1);
+            if(progress) progress->add(energy, energy*energy, 1, moved, 1, dr);
         }
+        if(progress) progress->finish();
+        accept_rate = static_cast<T>(accept)/maxstep;
         auto mean = etot/static_cast<T>(maxstep);
         // auto std = etot_sq/static_cast<T>(maxstep);
         // fmt::print("Accept ratio: {:.2f}, step size: {:6.4f}, last place: {:6.4f}\n", static_cast<T>(accept)/maxstep, dr, rold);
@@ -64,10 +117,70 @@ public:
         return std::make_pair(mean, std);
     }
 
+    // nwalker walkers moved in lockstep, one step moves all of them
+    std::pair<T, T> sample_batch(int nwalker, int maxstep=10000) {
+        std::mt19937_64 gen(rgen());
+        Array x = Array::Constant(nwalker, 0.5), y = x, z = x;
+        Array xnew(nwalker), ynew(nwalker), znew(nwalker), unif(nwalker);
+        Array rold = (x.square() + y.square() + z.square()).sqrt();
+        Array energy = energy_func(rold);
+        Array lold = logpsi(rold);
+        T etot = 0;
+        T etot_sq = 0;
+        long accept = 0;
+        blocking.reset(block);
+        auto progress = telemetry ? telemetry->begin(1, maxstep) : nullptr;
+        for(int i=0; i<maxstep; i++) {
+
+            dr = std::max(dr, 0.1);
+            dr = std::min(dr, 10.0);
+
+            uniform_fill(gen, xnew, -1.0, 1.0);
+            uniform_fill(gen, ynew, -1.0, 1.0);
+            uniform_fill(gen, znew, -1.0, 1.0);
+            uniform_fill(gen, unif, 0.0, 1.0);
+            xnew = x + dr*xnew;
+            ynew = y + dr*ynew;
+            znew = z + dr*znew;
+            Array rnew = (xnew.square() + ynew.square() + znew.square()).sqrt();
+
+            Array lnew = logpsi(rnew);
+            auto accepted = (unif.log() < 2*(lnew - lold)).eval();
+            x = accepted.select(xnew, x);
+            y = accepted.select(ynew, y);
+            z = accepted.select(znew, z);
+            rold = accepted.select(rnew, rold);
+            lold = accepted.select(lnew, lold);
+            // the local energy is one division per walker, cheaper to evaluate
+            // for all of them than to pack the accepted ones
+            energy = accepted.select(energy_func(rold), energy);
+            accept += accepted.count();
+
+            if(static_cast<T>(accept)/(static_cast<T>(i+1)*nwalker) > 0.5) dr*=scale;
+            else dr/=scale;
+
+            auto esum = energy.sum(), esq = energy.square().sum();
+            etot += esum;
+            etot_sq += esq;
+            blocking.add(esum, esq, nwalker);
+            if(progress) progress->add(esum, esq, nwalker, accepted.count(), nwalker, dr);
+        }
+        if(progress) progress->finish();
+        auto count = static_cast<T>(maxstep)*nwalker;
+        accept_rate = accept/count;
+        auto mean = etot/count;
+        auto std = std::sqrt(etot_sq/count - std::pow(mean, 2));
+        return std::make_pair(mean, std);
+    }
+
 private:
     T c, alpha;
     T dr;
     std::random_device rd;
     std::mt19937 rgen{rd()};
     const T scale = 1.01;
+    T accept_rate = 0.0;
+    long block = 0;
+    Blocking<T> blocking;
+    Telemetry* telemetry = nullptr;
 };
\ No newline at end of file
@@ -0,0 +1,355 @@
+#pragma once
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fmt/core.h>
+
+// Progress of one sampler thread, all doubles so that it is copied as an array.
+// The batches are the `stride` steps between two publications, their sums
+// s_b and counts c_b enter the error of the mean as in summarize()
+struct Snapshot {
+    double steps, target, seconds;
+    double count, sum, sum_sq, accepted, proposed;
+    // $$\sum_b s_b^2, \sum_b s_b c_b, \sum_b c_b^2$$ and the number of batches
+    double batch_sq, batch_cross, batch_count_sq, nbatch;
+    double dr, done;
+};
+
+// Written by one sampler thread, read by the reporter. The thread adds every
+// step to plain sums and publishes them every `stride` steps under a sequence
+// lock, so the hot loop never waits and the reader always gets one consistent
+// snapshot. The published copy sits between the sums of neighbouring slots,
+// so the threads do not share cache lines
+class Progress {
+public:
+    // reset before the run, by the thread starting the samplers
+    void start(long target, long n) {
+        stride = std::max(n, 1L);
+        pending = 0;
+        state = Snapshot();
+        state.target = target;
+        batch = {0, 0, 0, 0, 0};
+        begin = std::chrono::steady_clock::now();
+        publish();
+    }
+
+    // the energies sum and sum_sq of count samples of one step with `accepted`
+    // of `proposed` moves, at the step size dr
+    inline void add(double sum, double sum_sq, double count, double accepted, double proposed, double dr) {
+        batch.sum += sum;
+        batch.sum_sq += sum_sq;
+        batch.count += count;
+        batch.accepted += accepted;
+        batch.proposed += proposed;
+        state.dr = dr;
+        if(++pending == stride) flush();
+    }
+
+    // publish the last, partial batch and mark the run done
+    void finish() {
+        flush();
+        state.done = 1;
+        publish();
+    }
+
+    Snapshot snapshot() const {
+        double buf[nfield];
+        unsigned s;
+        do {
+            s = seq.load(std::memory_order_acquire);
+            for(int i=0; i<nfield; i++) buf[i] = fields[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while((s & 1) || seq.load(std::memory_order_relaxed) != s);
+        Snapshot ret;
+        std::memcpy(&ret, buf, sizeof(ret));
+        return ret;
+    }
+
+private:
+    static const int nfield = sizeof(Snapshot)/sizeof(double);
+    static_assert(sizeof(Snapshot) == nfield*sizeof(double), "Snapshot holds doubles only");
+
+    struct Batch {
+        double count, sum, sum_sq, accepted, proposed;
+    };
+
+    long stride = 1000;
+    long pending = 0;
+    Snapshot state = Snapshot();
+    Batch batch = {0, 0, 0, 0, 0};
+    std::chrono::steady_clock::time_point begin;
+    std::atomic<unsigned> seq{0};
+    std::atomic<double> fields[nfield];
+
+    void flush() {
+        if(pending == 0) return;
+        state.steps += pending;
+        state.count += batch.count;
+        state.sum += batch.sum;
+        state.sum_sq += batch.sum_sq;
+        state.accepted += batch.accepted;
+        state.proposed += batch.proposed;
+        state.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        state.batch_sq += batch.sum*batch.sum;
+        state.batch_cross += batch.sum*batch.count;
+        state.batch_count_sq += batch.count*batch.count;
+        state.nbatch += 1;
+        pending = 0;
+        batch = {0, 0, 0, 0, 0};
+        publish();
+    }
+
+    void publish() {
+        double buf[nfield];
+        std::memcpy(buf, &state, sizeof(state));
+        auto s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(int i=0; i<nfield; i++) fields[i].store(buf[i], std::memory_order_relaxed);
+        seq.store(s + 2, std::memory_order_release);
+    }
+};
+
+// Live metrics of a program: one Progress per sampler thread, combined into
+// the steps, steps/sec, mean and error of the energy, acceptance and step
+// size of the current run. serve() starts a reporter thread that rewrites a
+// file in the Prometheus text format every interval (to a temporary file,
+// then renamed, so that readers never see a partial one) and/or answers every
+// connection to a Unix-domain socket with the same text
+class Telemetry {
+public:
+    Telemetry(const std::string& program, int nslot=1, long stride=1000):
+        program(program), capacity(nslot), stride(stride), slots(new Progress[nslot]) {}
+
+    ~Telemetry() {
+        stop();
+    }
+
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator=(const Telemetry&) = delete;
+
+    // A new run of nslot threads of target steps each, thread i adds to the
+    // returned slots[i]. Call it before starting the threads
+    Progress* begin(int nslot, long target) {
+        if(nslot > capacity) {
+            throw std::runtime_error(fmt::format("Telemetry has {} slots, {} threads", capacity, nslot));
+        }
+        for(int i=0; i<nslot; i++) slots[i].start(target, stride);
+        start_ns.store(now_ns(), std::memory_order_relaxed);
+        active.store(nslot, std::memory_order_release);
+        runs.fetch_add(1, std::memory_order_relaxed);
+        return slots.get();
+    }
+
+    // the run so far, summed over the threads
+    struct Summary {
+        long runs;
+        double steps, target, seconds, rate, mean, std, error, acceptance, dr;
+        bool done;
+    };
+
+    Summary summary() const {
+        auto nan = std::numeric_limits<double>::quiet_NaN();
+        Summary ret = {runs.load(std::memory_order_relaxed), 0, 0, 0, 0, nan, nan, nan, nan, nan, false};
+        int n = active.load(std::memory_order_acquire);
+        if(n == 0) return ret;
+        Snapshot tot = Snapshot();
+        double running = std::numeric_limits<double>::infinity(), finished = 0;
+        bool done = true;
+        for(int i=0; i<n; i++) {
+            auto s = slots[i].snapshot();
+            // the threads move in lockstep, the slowest running one is the progress
+            if(s.done) finished = std::max(finished, s.steps);
+            else running = std::min(running, s.steps);
+            done = done && s.done;
+            tot.target = std::max(tot.target, s.target);
+            tot.seconds = std::max(tot.seconds, s.seconds);
+            tot.count += s.count;
+            tot.sum += s.sum;
+            tot.sum_sq += s.sum_sq;
+            tot.accepted += s.accepted;
+            tot.proposed += s.proposed;
+            tot.batch_sq += s.batch_sq;
+            tot.batch_cross += s.batch_cross;
+            tot.batch_count_sq += s.batch_count_sq;
+            tot.nbatch += s.nbatch;
+            tot.dr += s.dr/n;
+        }
+        ret.steps = done ? finished : running;
+        ret.target = tot.target;
+        ret.done = done;
+        ret.seconds = done ? tot.seconds : (now_ns() - start_ns.load(std::memory_order_relaxed))*1e-9;
+        // both at the last publication
+        if(tot.seconds > 0) ret.rate = ret.steps/tot.seconds;
+        ret.dr = tot.dr;
+        if(tot.proposed > 0) ret.acceptance = tot.accepted/tot.proposed;
+        if(tot.count == 0) return ret;
+        ret.mean = tot.sum/tot.count;
+        ret.std = std::sqrt(std::max(tot.sum_sq/tot.count - ret.mean*ret.mean, 0.0));
+        if(tot.nbatch < 2) return ret;
+        // $$\sum_b (s_b - c_b m)^2$$, the block error of summarize()
+        auto var = tot.batch_sq - 2*ret.mean*tot.batch_cross + ret.mean*ret.mean*tot.batch_count_sq;
+        ret.error = std::sqrt(std::max(var, 0.0)/(tot.count*tot.count)*tot.nbatch/(tot.nbatch - 1));
+        return ret;
+    }
+
+    // the metrics in the Prometheus text exposition format
+    std::string render() const {
+        auto s = summary();
+        std::string ret;
+        auto label = fmt::format("{{program=\"{}\"}}", program);
+        auto metric = [&](const char* name, const char* type, const char* help, double val) {
+            ret += fmt::format("# HELP {} {}\n# TYPE {} {}\n{}{} {}\n", name, help, name, type, name, label,
+                               prometheus(val));
+        };
+        metric("qmc_runs_total", "counter", "Sampling runs started", s.runs);
+        metric("qmc_steps", "gauge", "Monte Carlo steps done in the current run", s.steps);
+        metric("qmc_steps_target", "gauge", "Monte Carlo steps of the current run", s.target);
+        metric("qmc_steps_per_second", "gauge", "Monte Carlo steps per second of the current run", s.rate);
+        metric("qmc_elapsed_seconds", "gauge", "Seconds since the start of the current run", s.seconds);
+        metric("qmc_energy", "gauge", "Mean local energy (Hartree)", s.mean);
+        metric("qmc_energy_std", "gauge", "Standard deviation of the local energy (Hartree)", s.std);
+        metric("qmc_energy_error", "gauge", "Standard error of the mean energy (Hartree)", s.error);
+        metric("qmc_acceptance", "gauge", "Acceptance ratio of the moves", s.acceptance);
+        metric("qmc_step_size", "gauge", "Current step size dr", s.dr);
+        metric("qmc_done", "gauge", "1 when the current run has finished", s.done);
+        return ret;
+    }
+
+    // write render() to path atomically
+    void write(const std::string& path) const {
+        auto tmp = path + ".tmp";
+        {
+            std::ofstream output(tmp);
+            output << render();
+            if(!output) throw std::runtime_error("Cannot write the metrics " + tmp);
+        }
+        if(std::rename(tmp.c_str(), path.c_str()) != 0) throw std::runtime_error("Cannot rename the metrics " + tmp);
+    }
+
+    // Start the reporter thread, file and socket may be empty
+    void serve(const std::string& file, const std::string& socket, double interval) {
+        stop();
+        path = file;
+        socket_path = socket;
+        period = std::max(interval, 1e-3);
+        if(!socket_path.empty()) listen_fd = open_socket(socket_path);
+        if(pipe(wake) != 0) throw std::runtime_error("Cannot create the reporter pipe");
+        reporter = std::thread([this]() { report(); });
+    }
+
+    // stop the reporter after a last write of the file
+    void stop() {
+        if(!reporter.joinable()) return;
+        char ch = 0;
+        if(::write(wake[1], &ch, 1) != 1) std::perror("telemetry");
+        reporter.join();
+        close(wake[0]);
+        close(wake[1]);
+        if(listen_fd >= 0) {
+            close(listen_fd);
+            unlink(socket_path.c_str());
+            listen_fd = -1;
+        }
+        write_file();
+    }
+
+private:
+    std::string program;
+    int capacity;
+    long stride;
+    std::unique_ptr<Progress[]> slots;
+    std::atomic<int> active{0};
+    std::atomic<long> runs{0};
+    std::atomic<long long> start_ns{0};
+
+    std::string path, socket_path;
+    double period = 1.0;
+    int listen_fd = -1;
+    int wake[2] = {-1, -1};
+    std::thread reporter;
+
+    static long long now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static std::string prometheus(double val) {
+        if(std::isnan(val)) return "NaN";
+        if(std::isinf(val)) return val > 0 ? "+Inf" : "-Inf";
+        return fmt::format("{}", val);
+    }
+
+    // a failed write is reported and skipped, the run goes on
+    void write_file() const {
+        if(path.empty()) return;
+        try {
+            write(path);
+        } catch(const std::exception& e) {
+            fmt::print(stderr, "{}\n", e.what());
+        }
+    }
+
+    static int open_socket(const std::string& path) {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if(path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+        std::strcpy(addr.sun_path, path.c_str());
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0) throw std::runtime_error("Cannot create the socket " + path);
+        // a socket left over by an earlier run
+        unlink(path.c_str());
+        if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot listen on the socket " + path);
+        }
+        return fd;
+    }
+
+    // Write the file every period and answer the connections in between,
+    // until stop() writes to the pipe
+    void report() {
+        auto next = std::chrono::steady_clock::now();
+        while(true) {
+            auto now = std::chrono::steady_clock::now();
+            if(now >= next) {
+                write_file();
+                next = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(period));
+            }
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+            pollfd fds[2] = {{wake[0], POLLIN, 0}, {listen_fd, POLLIN, 0}};
+            int n = poll(fds, listen_fd >= 0 ? 2 : 1, static_cast<int>(std::max<long long>(wait, 1)));
+            if(n < 0 && errno != EINTR) break;
+            if(n <= 0) continue;
+            if(fds[0].revents) break;
+            if(listen_fd >= 0 && (fds[1].revents & POLLIN)) {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if(fd < 0) continue;
+                auto text = render();
+                size_t done = 0;
+                while(done < text.size()) {
+                    auto k = ::send(fd, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+                    if(k <= 0) break;
+                    done += k;
+                }
+                close(fd);
+            }
+        }
+    }
+};
@@ -0,0 +1,210 @@
+#include <gtest/gtest.h>
+#include <limits>
+#include <sstream>
+#include <vector>
+#include "hydrogen.hpp"
+
+typedef Eigen::Matrix<double, 1, 3> Coord;
+
+// H2 in STO-3G, one hydrogen with a 6-31G* like sp shell, and Slater s and
+// p functions on both
+const char* molden_h2 = R"(
+[Molden Format]
+[Atoms] Angs
+H     1    1    0.000000    0.000000    0.370424
+H     2    1    0.000000    0.000000   -0.370424
+[GTO]
+  1 0
+ s    3 1.00
+      3.42525091D+00  1.54328970D-01
+      6.23913730D-01  5.35328140D-01
+      1.68855400D-01  4.44634540D-01
+ p    1 1.00
+      1.10000000D+00  1.00000000D+00
+ s    1 1.00
+      1.10000000D+00  1.00000000D+00
+
+  2 0
+ s    3 1.00
+      3.42525091D+00  1.54328970D-01
+      6.23913730D-01  5.35328140D-01
+      1.68855400D-01  4.44634540D-01
+
+[STO]
+  1 0 0 0 0 1.2 0.8
+  2 0 0 1 0 0.9 0.3
+  2 0 0 0 1 0.7 0.2
+[MO]
+ Sym= 1Ag
+ Ene= -0.5782
+ Spin= Alpha
+ Occup= 2.0
+   1  0.5
+   2  0.1
+   3 -0.2
+   4  0.3
+   5  0.4
+   6  0.5
+   7  0.3
+   8  0.6
+   9  0.2
+ Sym= 1B1u
+ Ene= 0.6703
+ Occup= 0.0
+   1  1.0
+   6  1.0
+)";
+
+MoldenFile<double> h2_file() {
+    std::istringstream is(molden_h2);
+    return MoldenFile<double>::read(is);
+}
+
+template<typename Fn>
+Coord num_gradient(const Coord& p, Fn func) {
+    const double eps = 1e-5;
+    Coord ret;
+    for(int d=0; d<3; d++) {
+        Coord dp = Coord::Zero();
+        dp(d) = eps;
+        ret(d) = (func(p + dp) - func(p - dp))/(2*eps);
+    }
+    return ret;
+}
+
+template<typename Fn>
+double num_laplace(const Coord& p, Fn func) {
+    const double eps = 1e-4;
+    double ret = -6*func(p);
+    for(int d=0; d<3; d++) {
+        Coord dp = Coord::Zero();
+        dp(d) = eps;
+        ret += func(p + dp) + func(p - dp);
+    }
+    return ret/(eps*eps);
+}
+
+TEST(MoldenFile, Read) {
+    auto file = h2_file();
+    ASSERT_EQ(file.atoms.size(), 2u);
+    ASSERT_NEAR(file.atoms[0](2), 0.7, 1e-6);
+    // s, px, py, pz, s on the first atom, s on the second, three Slater functions
+    ASSERT_EQ(file.functions.size(), 9u);
+    ASSERT_EQ(file.functions[2].ly, 1);
+    ASSERT_TRUE(file.functions[8].slater);
+    ASSERT_EQ(file.mo.size(), 2u);
+    ASSERT_EQ(file.mo[1].size(), 9u);
+    ASSERT_DOUBLE_EQ(file.mo_energy[1], 0.6703);
+    ASSERT_DOUBLE_EQ(file.mo_occupation[0], 2.0);
+    // the two STO-3G 1s at a center, $$\sum_i d_i (2\alpha_i/\pi)^{3/4}(1 + e^{-\alpha_i R^2})$$
+    BasisOrbital<double> orbital(file, 1, file.atoms);
+    ASSERT_NEAR(orbital.value(file.atoms[0]), 0.7673844, 1e-6);
+    std::istringstream bad("[Atoms] AU\nH 1 1 0 0 0\n[GTO]\n  1 0\n d 1 1.0\n 1.0 1.0\n");
+    ASSERT_THROW(MoldenFile<double>::read(bad), std::runtime_error);
+}
+
+TEST(BasisOrbital, Derivatives) {
+    auto file = h2_file();
+    BasisOrbital<double> orbital(file, 0, file.atoms);
+    // the s and p functions of the sp shell share a primitive
+    ASSERT_EQ(orbital.primitives(), 3u + 1u + 3u + 3u);
+    for(int i=0; i<10; i++) {
+        Coord r = 1.5*Coord::Random();
+        double val, lap;
+        Coord grad;
+        orbital.evaluate(r, val, grad, lap);
+        auto func = [&](const Coord& p) { return orbital.value(p); };
+        ASSERT_NEAR(val, orbital.value(r), 1e-14);
+        ASSERT_NEAR((grad - num_gradient(r, func)).norm(), 0.0, 1e-6);
+        ASSERT_NEAR(lap, num_laplace(r, func), 1e-4);
+    }
+}
+
+TEST(BasisOrbital, Screening) {
+    auto file = h2_file();
+    BasisOrbital<double> screened(file, 0, file.atoms);
+    BasisOrbital<double> full(file, 0, file.atoms, std::numeric_limits<double>::infinity());
+    for(double dist: {0.1, 0.5, 1.0, 2.0, 4.0, 8.0}) {
+        Coord r = dist*Coord::Random().normalized();
+        double val1, val2, lap1, lap2;
+        Coord grad1, grad2;
+        screened.evaluate(r, val1, grad1, lap1);
+        full.evaluate(r, val2, grad2, lap2);
+        ASSERT_NEAR(val1, val2, 1e-14);
+        ASSERT_NEAR((grad1 - grad2).norm(), 0.0, 1e-13);
+        ASSERT_NEAR(lap1, lap2, 1e-12);
+    }
+}
+
+TEST(BasisWaveFn, SlaterMO) {
+    // one 1s Slater function per atom is the MO of MOWaveFn with c = 0
+    std::istringstream is("[Atoms] AU\nH 1 1 0.7 0 0\nH 2 1 -0.7 0 0\n"
+                          "[STO]\n1 0 0 0 0 1.2 1.0\n2 0 0 0 0 1.2 1.0\n[MO]\nOccup= 2\n1 1.0\n2 1.0\n");
+    auto file = MoldenFile<double>::read(is);
+    Coord R1, R2;
+    R1 << 0.3, 0.1, 0.0;
+    R2 << -0.5, 0.2, 0.4;
+    BasisWaveFn<double> basis(file, 0, R1, R2);
+    MOWaveFn<double> mo(0.0, 1.2, R1, R2);
+    for(int i=0; i<5; i++) {
+        Coord r = Coord::Random();
+        ASSERT_NEAR(basis.value(r), mo.value(r), 1e-12);
+        ASSERT_NEAR((basis.grad(r) - mo.grad(r)).norm(), 0.0, 1e-12);
+        ASSERT_NEAR(basis.laplace(r), mo.laplace(r), 1e-10);
+        auto ng1 = basis.nuclear_grad(r), ng2 = mo.nuclear_grad(r);
+        ASSERT_NEAR((ng1.first - ng2.first).norm(), 0.0, 1e-12);
+        ASSERT_NEAR((ng1.second - ng2.second).norm(), 0.0, 1e-12);
+    }
+}
+
+TEST(BasisWaveFn, Charges) {
+    // a helium atom would run silently as a proton
+    std::istringstream is("[Atoms] AU\nHe 1 2 0.7 0 0\nH 2 1 -0.7 0 0\n"
+                          "[STO]\n1 0 0 0 0 1.2 1.0\n2 0 0 0 0 1.2 1.0\n[MO]\nOccup= 2\n1 1.0\n2 1.0\n");
+    auto file = MoldenFile<double>::read(is);
+    ASSERT_THROW(BasisWaveFn<double>(file, 0, file.atoms[0], file.atoms[1]), std::runtime_error);
+}
+
+TEST(BasisWaveFn, Nucleus) {
+    // a 1s Slater function is e^{-zeta r}, also exactly on its nucleus
+    std::istringstream is("[Atoms] AU\nH 1 1 0.7 0 0\nH 2 1 -0.7 0 0\n"
+                          "[STO]\n1 0 0 0 0 1.2 1.0\n1 0 0 0 1 0.9 0.3\n2 0 0 0 0 1.2 1.0\n"
+                          "[MO]\nOccup= 2\n1 1.0\n2 0.5\n3 1.0\n");
+    auto file = MoldenFile<double>::read(is);
+    BasisWaveFn<double> basis(file, 0, file.atoms[0], file.atoms[1]);
+    MOWaveFn<double> mo(0.0, 1.2, file.atoms[0], file.atoms[1]);
+    auto r = file.atoms[0];
+    ASSERT_NEAR(basis.value(r), mo.value(r), 1e-14);
+    // the r e^{-zeta r} term vanishes there and leaves no NaN either
+    BasisOrbital<double> orbital(file, 0, file.atoms);
+    double val, lap;
+    Coord grad;
+    orbital.evaluate(r, val, grad, lap);
+    ASSERT_NEAR(val, mo.value(r), 1e-14);
+    ASSERT_NEAR((grad - mo.grad(r)).norm(), 0.0, 1e-14);
+    ASSERT_EQ(lap, -std::numeric_limits<double>::infinity());
+    ASSERT_EQ(lap, mo.laplace(r));
+}
+
+TEST(BasisWaveFn, H2MolQMC) {
+    auto file = std::make_shared<MoldenFile<double>>(h2_file());
+    // the unnormalized STO-3G sigma_g, at the geometry of the file
+    H2MolQMC<double, JastrowType::SIMPLE_JASTROW, AtomicWfnType::BASIS> qmc(
+        JastrowParam<double>(1.0), 0.0, 1.0, file->atoms[0], file->atoms[1], 1.0, file, 1);
+    qmc.set_verbose(false);
+    qmc.seed(3);
+    auto ret = qmc.sample(50000);
+    // exact -1.174, RHF/STO-3G -1.117
+    ASSERT_GT(ret.first, -1.20);
+    ASSERT_LT(ret.first, -1.05);
+    auto force = qmc.sample_force(20000);
+    ASSERT_TRUE(std::isfinite(force.force1(2)));
+    ASSERT_THROW((H2Mol<double, JastrowType::SIMPLE_JASTROW, AtomicWfnType::BASIS>(
+        JastrowParam<double>(1.0), 0.0, 1.0, file->atoms[0], file->atoms[1])), std::runtime_error);
+    ASSERT_THROW(qmc.set_symmetry(true), std::invalid_argument);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
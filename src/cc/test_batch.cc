@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "batch.hpp"
+
+std::vector<Job> parse(const std::string& text) {
+    std::istringstream is(text);
+    return read_jobs(is);
+}
+
+// the message of the error read_jobs throws
+std::string parse_error(const std::string& text) {
+    try {
+        parse(text);
+    } catch(const std::runtime_error& e) {
+        return e.what();
+    }
+    return "";
+}
+
+TEST(ReadJobs, Parse) {
+    auto jobs = parse("# comment\n\n"
+                      "name=h2 system=h2 jastrow=en-pade b=0.3 r1=0.7,0,0 r2=-0.7,0,0 nstep=1000 seed=2 # tail\n"
+                      "system=hydrogen alpha=0.9\n");
+    ASSERT_EQ(jobs.size(), 2u);
+    ASSERT_EQ(jobs[0].name, "h2");
+    ASSERT_EQ(jobs[0].nstep, 1000);
+    ASSERT_EQ(jobs[0].seed, 2u);
+    ASSERT_DOUBLE_EQ(jobs[0].get("b", 1.0), 0.3);
+    ASSERT_DOUBLE_EQ(jobs[0].get("r2", PCoord<double>::Zero().eval())(0), -0.7);
+    ASSERT_EQ(jobs[1].name, "job1");
+    ASSERT_DOUBLE_EQ(jobs[1].get("alpha", 1.0), 0.9);
+    ASSERT_DOUBLE_EQ(jobs[1].get("c", 0.1), 0.1);
+}
+
+TEST(ReadJobs, Errors) {
+    // misspelled, foreign and repeated keys, the line is named
+    ASSERT_EQ(parse_error("system=hydrogen c=0.1\nsystem=hydrogen alpah=0.5\n"),
+              "Line 2: Unknown key alpah for system hydrogen");
+    ASSERT_EQ(parse_error("system=heg jastrow=simple\n"), "Line 1: Unknown key jastrow for system heg");
+    ASSERT_EQ(parse_error("system=heg nshell=2.5\n"), "Line 1: Invalid integer nshell=2.5");
+    ASSERT_EQ(parse_error("system=heg nshell=0\n"), "Line 1: Invalid nshell=0");
+    ASSERT_EQ(parse_error("system=h2 b=0.1 b=0.2\n"), "Line 1: Repeated key b");
+    ASSERT_EQ(parse_error("system=h3\n"), "Line 1: Invalid system h3");
+    ASSERT_EQ(parse_error("system=hydrogen nstep=10x\n"), "Line 1: Invalid integer nstep=10x");
+    ASSERT_EQ(parse_error("system=hydrogen nstep=0\n"), "Line 1: Invalid nstep=0");
+    ASSERT_EQ(parse_error("system=hydrogen c=abc\n"), "Line 1: Invalid number c=abc");
+    ASSERT_EQ(parse_error("system=h2 r1=0.7,0\n"), "Line 1: Invalid coordinate r1=0.7,0");
+    ASSERT_EQ(parse_error("system=h2 jastrow=none\n"), "Line 1: Invalid jastrow function: none");
+    ASSERT_EQ(parse_error("system=h2 jastrow=en-pade a=0.3\n"), "Line 1: The en-pade Jastrow factor has no parameter a");
+    ASSERT_EQ(parse_error("system=h2 b=0.3\n"), "Line 1: The simple Jastrow factor has no parameter b");
+    ASSERT_EQ(parse_error("system=hydrogen c\n"), "Line 1: expect key=value, got c");
+    ASSERT_EQ(parse_error("name=a system=hydrogen\n\nname=a system=heg\n"), "Line 3: Name a already used on line 1");
+}
+
+TEST(ReadJobs, Seeds) {
+    // jobs without seed= get different streams, kept when the file is reordered
+    auto jobs = parse("name=a system=hydrogen\nname=b system=hydrogen\nname=c system=hydrogen seed=7\n");
+    auto swapped = parse("name=b system=hydrogen\nname=a system=hydrogen\n");
+    ASSERT_NE(jobs[0].seed, jobs[1].seed);
+    ASSERT_EQ(jobs[0].seed, swapped[1].seed);
+    ASSERT_EQ(jobs[2].seed, 7u);
+    RngService rng(2021), other(2022);
+    ASSERT_NE(rng.seed(jobs[0].seed), rng.seed(jobs[1].seed));
+    ASSERT_EQ(rng.seed(5), RngService(2021).seed(5));
+    ASSERT_NE(rng.seed(5), other.seed(5));
+}
+
+TEST(RunJobs, Threads) {
+    auto jobs = parse("name=a system=hydrogen c=0.1 nstep=20000\nname=b system=hydrogen c=0.1 nstep=20000\n"
+                      "name=c system=h2 jastrow=pade nstep=5000\n");
+    RngService rng(3);
+    auto serial = run_jobs(jobs, rng, 1), parallel = run_jobs(jobs, rng, 3);
+    ASSERT_EQ(serial.size(), 3u);
+    for(size_t i=0; i<serial.size(); i++) {
+        ASSERT_EQ(serial[i].name, jobs[i].name);
+        ASSERT_TRUE(serial[i].error.empty());
+        ASSERT_EQ(serial[i].energy, parallel[i].energy);
+    }
+    // the same parameters, different names
+    ASSERT_NE(serial[0].energy, serial[1].energy);
+}
+
+TEST(WriteResults, Escape) {
+    JobResult r;
+    r.name = "x,y \"q\"";
+    r.system = "hydrogen";
+    r.seed = 1;
+    r.nstep = 10;
+    r.energy = std::numeric_limits<double>::quiet_NaN();
+    r.energy_std = 0.5;
+    r.error = "line\n\ttab\x01";
+    std::ostringstream csv, json;
+    write_csv(csv, {r});
+    ASSERT_EQ(csv.str(), "name,system,seed,nstep,energy,energy_std,accept,seconds,error\n"
+                         "\"x,y \"\"q\"\"\",hydrogen,1,10,nan,0.5,0.000000,0.000000,\"line\n\ttab\x01\"\n");
+    write_json(json, {r});
+    ASSERT_EQ(json.str(), "[\n  {\"name\": \"x,y \\\"q\\\"\", \"system\": \"hydrogen\", \"seed\": 1, \"nstep\": 10, "
+                          "\"energy\": null, \"energy_std\": 0.5, \"accept\": 0, \"seconds\": 0, "
+                          "\"error\": \"line\\n\\ttab\\u0001\"}\n]\n");
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
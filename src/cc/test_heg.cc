@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "heg.hpp"
+
+TEST(HEG, Shells) {
+    // closed shells of 1, 7, 19, 27, 33 plane waves per spin
+    int expect[] = {2, 14, 38, 54, 66};
+    for(int i=0; i<5; i++) ASSERT_EQ(HEG<double>(i + 1, 1.0).electrons(), expect[i]);
+}
+
+TEST(HEG, Madelung) {
+    // two electrons at (0,0,0) and (L/2,L/2,L/2) form the bcc Wigner crystal,
+    // $$E/N = -0.895929/r_s$$
+    double rs = 1.5;
+    for(double tol: {1e-6, 1e-10}) {
+        HEG<double> heg(1, rs, tol);
+        auto L = heg.box();
+        std::vector<PCoord<double>> coords(2);
+        coords[0] << 0.0, 0.0, 0.0;
+        coords[1] << L/2, L/2, L/2;
+        heg.set_positions(coords);
+        ASSERT_NEAR(heg.potential()/2, -0.895929255682/rs, 1e-5);
+    }
+}
+
+TEST(HEG, Updates) {
+    HEG<double> heg(3, 2.0);
+    auto L = heg.box();
+    std::vector<PCoord<double>> coords(heg.electrons());
+    for(auto& r: coords) r = L*(PCoord<double>::Random() + PCoord<double>::Ones())/2;
+    heg.set_positions(coords);
+    for(int step=0; step<200; step++) {
+        int e = step % heg.electrons();
+        PCoord<double> r = heg.positions()[e] + 0.3*PCoord<double>::Random();
+        auto old = heg.log_value();
+        auto ratio = heg.ratio(e, r);
+        HEG<double> ref(3, 2.0);
+        auto moved = heg.positions();
+        moved[e] = r;
+        ref.set_positions(moved);
+        ASSERT_NEAR(std::log(std::abs(ratio)), ref.log_value() - old, 1e-8);
+        heg.accept();
+    }
+    HEG<double> ref(3, 2.0);
+    ref.set_positions(heg.positions());
+    ASSERT_NEAR(heg.potential(), ref.potential(), 1e-8);
+    ASSERT_NEAR(heg.kinetic(), ref.kinetic(), 1e-12);
+}
+
+TEST(HEGQMC, Energy) {
+    // Slater determinant only, <H> is the Hartree-Fock energy of the 38 electrons,
+    // the kinetic energy of the 19 plane waves per spin, the exchange
+    // $$-\frac{1}{V}\sum_{\sigma}\sum_{k \neq k'} \frac{2\pi}{|k-k'|^2}$$ and the Madelung energy
+    HEGQMC<double> qmc(3, 2.0, 0.5);
+    qmc.seed(7);
+    qmc.set_verbose(false);
+    auto ret = qmc.sample(400);
+    ASSERT_NEAR(ret.first, 0.018020, 0.01);
+    ASSERT_GT(qmc.accept_ratio(), 0.3);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
+#include <cstdio>
+#include <numeric>
+#include <sstream>
 #include "hydrogen.hpp"
+#include "simple_qmc.hpp"
 //#include <unsupported/Eigen/MatrixFunctions>
 
 // Given the function, return the graidents 
@@ -104,6 +108,20 @@ TEST(AtomicWaveFn, Laplacian) {
     delete wfn;
 }
 
+TEST(AtomicWaveFn, LogDomain) {
+    // ln|psi| on both sides of the node at r = 1/|c|
+    AtomicWaveFn<double> wfn(-0.8, 1.0);
+    BCoord<double> coord(3);
+    BArray<double> val;
+    for(int i=0; i<3; i++) coord.set_row(i, Eigen::Matrix<double, 1, 3>(0.5 + i, 0.3, -0.2));
+    wfn.log_value_batch(coord, val);
+    for(int i=0; i<3; i++) {
+        auto p = coord.row(i);
+        ASSERT_NEAR(wfn.log_value(p), std::log(std::abs(wfn.value(p))), 1e-12);
+        ASSERT_NEAR(val(i), wfn.log_value(p), 1e-12);
+    }
+}
+
 TEST(VBWaveFn, Gradient) {
     Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random(); 
     Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random(); 
@@ -160,6 +178,42 @@ TEST(MOWaveFn, Laplacian) {
     delete wfn;
 }
 
+TEST(MOWaveFn, LogDomain) {
+    Eigen::Matrix<double, 1, 3> R1, R2, far;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    // c < 0 has orbitals of both signs away from the nuclei
+    for(double c: {0.5, -0.3}) {
+        MOWaveFn<double> wfn(c, 1.0, R1, R2);
+        BCoord<double> coord(8);
+        BArray<double> batch;
+        for(int i=0; i<8; i++) coord.set_row(i, 4*Eigen::Matrix<double, 1, 3>::Random());
+        wfn.log_value_batch(coord, batch);
+        for(int i=0; i<8; i++) {
+            Eigen::Matrix<double, 1, 3> r = coord.row(i), grad;
+            double lap;
+            auto val = wfn.value(r);
+            ASSERT_NEAR(wfn.log_value(r), std::log(std::abs(val)), 1e-10);
+            ASSERT_NEAR(batch(i), wfn.log_value(r), 1e-12);
+            wfn.log_derivs(r, grad, lap);
+            ASSERT_NEAR((grad - wfn.grad(r)/val).norm(), 0.0, 1e-8);
+            ASSERT_NEAR(lap, wfn.laplace(r)/val - grad.squaredNorm(), 1e-8);
+        }
+        // e^{-alpha r} underflows, its logarithm does not
+        far << 800.0, 1.0, 0.0;
+        ASSERT_EQ(wfn.value(far), 0.0);
+        ASSERT_TRUE(std::isfinite(wfn.log_value(far)));
+        auto d1 = (far - R1).norm(), d2 = (far - R2).norm();
+        ASSERT_NEAR(wfn.log_value(far), std::log(std::abs(1 + c*d2)) - d2 +
+                    std::log(std::abs(1 + (1 + c*d1)/(1 + c*d2)*std::exp(d2 - d1))), 1e-9);
+        Eigen::Matrix<double, 1, 3> grad;
+        double lap;
+        wfn.log_derivs(far, grad, lap);
+        ASSERT_TRUE(std::isfinite(lap));
+        ASSERT_NEAR(grad(0), c/(1 + c*800) - 1, 1e-2);
+    }
+}
+
 TEST(JastrowWfn, Gradient) {
     Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random(); 
     Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random(); 
@@ -198,7 +252,633 @@ TEST(JastrowWfn, Laplacian) {
     delete wfn;
 }
 
+TEST(PadeJastrowWfn, Gradient) {
+    Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random(); 
+    auto wfn = new PadeJastrowWfn<double>(0.4, 0.7);
+    auto func1 = [&](const Eigen::Matrix<double, 1, 3>& p) {
+         return wfn->value(p, r2);
+    };
+    auto func2 = [&](const Eigen::Matrix<double, 1, 3>& p) {
+         return wfn->value(r1, p);
+    };
+    Eigen::Matrix<double, 1, 3> derv_f1, derv_f2;
+    auto nderv_f1 = gradient(r1, func1);
+    auto nderv_f2 = gradient(r2, func2);
+    std::tie(derv_f1, derv_f2) = wfn->grad(r1, r2);
+    ASSERT_NEAR((nderv_f1 - derv_f1).norm(), 0.0, 1e-6);
+    ASSERT_NEAR((nderv_f2 - derv_f2).norm(), 0.0, 1e-6);
+    delete wfn;
+}
+
+TEST(PadeJastrowWfn, Laplacian) {
+    Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random(); 
+    auto wfn = new PadeJastrowWfn<double>(0.4, 0.7);
+    auto func1 = [&](const Eigen::Matrix<double, 1, 3>& p) {
+         return wfn->value(p, r2);
+    };
+    auto func2 = [&](const Eigen::Matrix<double, 1, 3>& p) {
+         return wfn->value(r1, p);
+    };
+    auto nderv2_f1 = laplace(r1, func1);
+    auto nderv2_f2 = laplace(r2, func2);
+    double derv2_f1, derv2_f2;
+    std::tie(derv2_f1, derv2_f2) = wfn->laplace(r1, r2);
+    ASSERT_NEAR(nderv2_f1, derv2_f1, 1e-2);
+    ASSERT_NEAR(nderv2_f2, derv2_f2, 1e-2);
+    delete wfn;
+}
+
+TEST(ENPadeJastrowWfn, Gradient) {
+    Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> R1 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> R2 = Eigen::Matrix<double, 1, 3>::Random(); 
+    auto wfn = new ENPadeJastrowWfn<double>(0.7, 0.3, 1.2, R1, R2);
+    auto func1 = [&](const Eigen::Matrix<double, 1, 3>& p) {
+         return wfn->value(p, r2);
+    };
+    auto func2 = [&](const Eigen::Matrix<double, 1, 3>& p) {
+         return wfn->value(r1, p);
+    };
+    Eigen::Matrix<double, 1, 3> derv_f1, derv_f2;
+    auto nderv_f1 = gradient(r1, func1);
+    auto nderv_f2 = gradient(r2, func2);
+    std::tie(derv_f1, derv_f2) = wfn->grad(r1, r2);
+    ASSERT_NEAR((nderv_f1 - derv_f1).norm(), 0.0, 1e-6);
+    ASSERT_NEAR((nderv_f2 - derv_f2).norm(), 0.0, 1e-6);
+    delete wfn;
+}
+
+TEST(ENPadeJastrowWfn, Laplacian) {
+    Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> R1 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> R2 = Eigen::Matrix<double, 1, 3>::Random(); 
+    auto wfn = new ENPadeJastrowWfn<double>(0.7, 0.3, 1.2, R1, R2);
+    auto func1 = [&](const Eigen::Matrix<double, 1, 3>& p) {
+         return wfn->value(p, r2);
+    };
+    auto func2 = [&](const Eigen::Matrix<double, 1, 3>& p) {
+         return wfn->value(r1, p);
+    };
+    auto nderv2_f1 = laplace(r1, func1);
+    auto nderv2_f2 = laplace(r2, func2);
+    double derv2_f1, derv2_f2;
+    std::tie(derv2_f1, derv2_f2) = wfn->laplace(r1, r2);
+    ASSERT_NEAR(nderv2_f1, derv2_f1, 1e-2);
+    ASSERT_NEAR(nderv2_f2, derv2_f2, 1e-2);
+    delete wfn;
+}
+
+TEST(H2Mol, NuclearGradient) {
+    Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> R1 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> R2 = Eigen::Matrix<double, 1, 3>::Random(); 
+    JastrowParam<double> param(1.0, 0.5, 0.7, 0.3, 1.2);
+    auto mol = new H2Mol<double, JastrowType::EN_PADE_JASTROW, AtomicWfnType::VB>(param, 0.5, 1.0, R1, R2);
+    // ln psi = ln(rho)/2 as a function of the nuclear coordinates
+    auto func1 = [&](const Eigen::Matrix<double, 1, 3>& p) {
+        H2Mol<double, JastrowType::EN_PADE_JASTROW, AtomicWfnType::VB> m(param, 0.5, 1.0, p, R2);
+        return 0.5*std::log(m.density(r1, r2));
+    };
+    auto func2 = [&](const Eigen::Matrix<double, 1, 3>& p) {
+        H2Mol<double, JastrowType::EN_PADE_JASTROW, AtomicWfnType::VB> m(param, 0.5, 1.0, R1, p);
+        return 0.5*std::log(m.density(r1, r2));
+    };
+    Eigen::Matrix<double, 1, 3> f1, f2, dlog1, dlog2;
+    mol->force(r1, r2, f1, f2, dlog1, dlog2);
+    ASSERT_NEAR((gradient(R1, func1) - dlog1).norm(), 0.0, 1e-6);
+    ASSERT_NEAR((gradient(R2, func2) - dlog2).norm(), 0.0, 1e-6);
+    delete mol;
+}
+
+TEST(H2Symmetry, Images) {
+    typedef Eigen::Matrix<double, 1, 3> Coord;
+    Coord R1, R2;
+    R1 << 0.3, 0.5, -0.2;
+    R2 << -0.4, 0.1, 0.6;
+    JastrowParam<double> param(1.0, 0.5, 0.7, 0.3, 1.2);
+    H2Mol<double, JastrowType::EN_PADE_JASTROW, AtomicWfnType::VB> mol(param, 0.5, 1.0, R1, R2);
+    H2Symmetry<double> sym(R1, R2);
+    Coord r1 = Coord::Random(), r2 = Coord::Random();
+    Coord f1, f2, dlog1, dlog2, g1, g2, gdlog1, gdlog2;
+    mol.force(r1, r2, f1, f2, dlog1, dlog2);
+    auto energy = mol.energy(r1, r2);
+    ASSERT_NEAR(mol.energy(r2, r1), energy, 1e-10);
+    for(int g=0; g<sym.size(); g++) {
+        // the nuclei go to each other or stay
+        ASSERT_NEAR((sym.image(g, R1) - (sym.swaps(g) ? R2 : R1)).norm(), 0.0, 1e-12);
+        Coord i1 = sym.image(g, r1), i2 = sym.image(g, r2);
+        ASSERT_NEAR(mol.energy(i1, i2), energy, 1e-10);
+        ASSERT_NEAR(mol.energy(i2, i1), energy, 1e-10);
+        // the vectors of the image are those of the mapped nucleus, transformed
+        mol.force(i1, i2, g1, g2, gdlog1, gdlog2);
+        Coord zero = Coord::Zero();
+        Coord t1 = sym.image(g, zero) - sym.image(g, sym.swaps(g) ? f2 : f1);
+        Coord t2 = sym.image(g, zero) - sym.image(g, sym.swaps(g) ? dlog2 : dlog1);
+        ASSERT_NEAR((g1 + t1).norm(), 0.0, 1e-10);
+        ASSERT_NEAR((gdlog1 + t2).norm(), 0.0, 1e-10);
+    }
+    // the average points along the bond, opposite on the two nuclei
+    sym.average(f1, f2);
+    Coord axis = (R1 - R2).normalized();
+    ASSERT_NEAR((f1 - f1.dot(axis)*axis).norm(), 0.0, 1e-12);
+    ASSERT_NEAR((f1 + f2).norm(), 0.0, 1e-12);
+}
+
+TEST(H2MolQMC, Symmetry) {
+    Eigen::Matrix<double, 1, 3> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    H2MolQMC<double, JastrowType::SIMPLE_JASTROW> qmc1(JastrowParam<double>(1.0), 0.0, 1.0, R1, R2, 1.0);
+    H2MolQMC<double, JastrowType::SIMPLE_JASTROW> qmc2(JastrowParam<double>(1.0), 0.0, 1.0, R1, R2, 1.0);
+    qmc1.set_verbose(false);
+    qmc2.set_verbose(false);
+    qmc1.seed(11);
+    qmc2.seed(11);
+    qmc2.set_symmetry(true);
+    auto plain = qmc1.sample_force(20000);
+    auto sym = qmc2.sample_force(20000);
+    // same chain, the energy does not change on the images
+    ASSERT_EQ(plain.energy, sym.energy);
+    ASSERT_NEAR(sym.force1(0), -sym.force2(0), 1e-12);
+    ASSERT_NEAR(sym.force1(1), 0.0, 1e-12);
+    ASSERT_NEAR(sym.error1(2), 0.0, 1e-12);
+    ASSERT_LT(sym.error1(0), plain.error1(0));
+}
+
+TEST(H2MolQMC, ForceError) {
+    // the error bars follow the scatter of the forces between independent runs
+    Eigen::Matrix<double, 1, 3> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    H2MolQMC<double, JastrowType::SIMPLE_JASTROW> qmc(JastrowParam<double>(1.0), 0.0, 1.0, R1, R2, 1.0);
+    qmc.set_verbose(false);
+    const int nrun = 40;
+    double sum = 0, sum_sq = 0, err_sq = 0;
+    for(int i=0; i<nrun; i++) {
+        qmc.seed(100 + i);
+        auto ret = qmc.sample_force(4000);
+        sum += ret.force1(0);
+        sum_sq += ret.force1(0)*ret.force1(0);
+        err_sq += ret.error1(0)*ret.error1(0);
+    }
+    auto mean = sum/nrun;
+    auto scatter = std::sqrt((sum_sq/nrun - mean*mean)*nrun/(nrun - 1));
+    auto error = std::sqrt(err_sq/nrun);
+    ASSERT_GT(error, 0.6*scatter);
+    ASSERT_LT(error, 1.5*scatter);
+    // one block has no error
+    qmc.set_block(4000);
+    ASSERT_EQ(qmc.sample_force(4000).error1.norm(), 0.0);
+}
+
+// energy_std of the same chain with another Jastrow factor, c = 0, alpha = 1.2
+template<JastrowType Jastrow>
+double jastrow_std(const JastrowParam<double>& param) {
+    Eigen::Matrix<double, 1, 3> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    H2MolQMC<double, Jastrow> qmc(param, 0.0, 1.2, R1, R2, 1.0);
+    qmc.set_verbose(false);
+    qmc.seed(5);
+    return qmc.sample(50000).second;
+}
+
+TEST(H2MolQMC, JastrowVariance) {
+    // the simple factor is the cusp Pade with b = 1/F
+    auto simple = jastrow_std<JastrowType::SIMPLE_JASTROW>(JastrowParam<double>(1.0));
+    auto simple2 = jastrow_std<JastrowType::SIMPLE_JASTROW>(JastrowParam<double>(2.0));
+    ASSERT_NEAR(jastrow_std<JastrowType::PADE_JASTROW>(JastrowParam<double>(1.0, 0.5, 1.0)), simple, 1e-8);
+    ASSERT_NEAR(jastrow_std<JastrowType::PADE_JASTROW>(JastrowParam<double>(1.0, 0.5, 0.5)), simple2, 1e-8);
+    // without the e-e cusp the variance grows
+    ASSERT_GT(jastrow_std<JastrowType::PADE_JASTROW>(JastrowParam<double>(1.0, 0.0, 1.0)), 1.5*simple);
+    ASSERT_GT(jastrow_std<JastrowType::PADE_JASTROW>(JastrowParam<double>(1.0, 0.25, 1.0)), 1.1*simple);
+    // and a longer range than F = 1 lowers it
+    ASSERT_LT(simple2, simple);
+    // the defaults of the e-n terms beat the simple factor at its best F
+    auto best = simple;
+    for(double F: {1.5, 2.0, 2.5, 3.0}) {
+        best = std::min(best, jastrow_std<JastrowType::SIMPLE_JASTROW>(JastrowParam<double>(F)));
+    }
+    ASSERT_LT(jastrow_std<JastrowType::EN_PADE_JASTROW>(JastrowParam<double>()), 0.9*best);
+}
+
+TEST(H2MolQMC, Seed) {
+    Eigen::Matrix<double, 1, 3> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    H2MolQMC<double> qmc1(1.0, 0.0, 1.0, R1, R2, 1.0);
+    H2MolQMC<double> qmc2(1.0, 0.0, 1.0, R1, R2, 1.0);
+    qmc1.set_verbose(false);
+    qmc2.set_verbose(false);
+    qmc1.seed(42);
+    qmc2.seed(42);
+    ASSERT_EQ(qmc1.sample(1000), qmc2.sample(1000));
+}
+
+TEST(WalkerPool, CopyRemove) {
+    Arena arena(WalkerPool<double>::bytes(2, 20));
+    WalkerPool<double> pool(arena, 2, 20);
+    ASSERT_EQ(reinterpret_cast<size_t>(pool.pos(1, 2)) % Arena::alignment, 0u);
+    for(int i=0; i<3; i++) {
+        auto w = pool.add();
+        pool.set_position(w, 0, Eigen::Matrix<double, 1, 3>::Constant(i));
+        pool.set_position(w, 1, Eigen::Matrix<double, 1, 3>::Constant(-i));
+        pool.eloc(w) = i;
+    }
+    auto w = pool.copy(1);
+    ASSERT_EQ(pool.size(), 4u);
+    ASSERT_EQ(pool.position(w, 1), pool.position(1, 1));
+    ASSERT_EQ(pool.eloc(w), 1.0);
+    pool.remove(0);
+    ASSERT_EQ(pool.size(), 3u);
+    ASSERT_EQ((pool.position(0, 0)), (Eigen::Matrix<double, 1, 3>::Constant(1)));
+    ASSERT_EQ(pool.eloc(0), 1.0);
+    auto slice = pool.slice(1, 2);
+    ASSERT_EQ(slice.first, pool.size());
+    ASSERT_FALSE(pool.paged(2));
+}
+
+TEST(WalkerPool, Pages) {
+    // with a page per thread the slices own whole pages of every array
+    const size_t page = WalkerPool<double>::page;
+    Arena arena(WalkerPool<double>::bytes(2, 3*page + 100) + 64);
+    arena.allocate<char>(1);
+    WalkerPool<double> pool(arena, 2, 3*page + 100);
+    ASSERT_EQ(pool.capacity(), 4*page);
+    for(size_t i=0; i<3*page + 100; i++) pool.add();
+    ASSERT_TRUE(pool.paged(3));
+    ASSERT_FALSE(pool.paged(4));
+    size_t last = 0;
+    for(int tid=0; tid<3; tid++) {
+        auto slice = pool.slice(tid, 3);
+        ASSERT_EQ(slice.first, last);
+        ASSERT_EQ(reinterpret_cast<size_t>(pool.pos(1, 2) + slice.first) % Arena::page, 0u);
+        ASSERT_EQ(reinterpret_cast<size_t>(&pool.eloc(slice.first)) % Arena::page, 0u);
+        last = slice.second;
+    }
+    ASSERT_EQ(last, pool.size());
+    ASSERT_EQ(pool.slice(0, 3).second, 2*page);
+    // under a page per thread, cache lines
+    auto slice = pool.slice(1, 4);
+    ASSERT_EQ(slice.first % WalkerPool<double>::line, 0u);
+    ASSERT_EQ(pool.slice(3, 4).second, pool.size());
+}
+
+TEST(H2MolQMC, Walkers) {
+    Eigen::Matrix<double, 1, 3> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    H2MolQMC<double> qmc(1.0, 0.0, 1.0, R1, R2, 1.0);
+    qmc.set_verbose(false);
+    qmc.seed(42);
+    auto single = qmc.sample(400000);
+    auto multi = qmc.sample_walkers(40, 10000, 2);
+    ASSERT_NEAR(single.first, multi.first, 0.01);
+    ASSERT_NEAR(single.second, multi.second, 0.05);
+}
+
+TEST(ADWaveFn, AtomicWaveFn) {
+    auto ref = new AtomicWaveFn<double>(0.5, 1.0);
+    auto wfn = new ADWaveFn<double, AtomicOrbital<double>>(AtomicOrbital<double>{0.5, 1.0});
+    Eigen::Matrix<double, 1, 3> p = Eigen::Matrix<double, 1, 3>::Random(); 
+    double val, lap;
+    Eigen::Matrix<double, 1, 3> derv;
+    wfn->evaluate(p, val, derv, lap);
+    ASSERT_NEAR(val, ref->value(p), 1e-12);
+    ASSERT_NEAR((derv - ref->grad(p)).norm(), 0.0, 1e-12);
+    ASSERT_NEAR(lap, ref->laplace(p), 1e-10);
+    ASSERT_NEAR(wfn->value(p), ref->value(p), 1e-12);
+    delete wfn;
+    delete ref;
+}
+
+TEST(ADJastrowWfn, JastrowWfn) {
+    Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random(); 
+    Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random(); 
+    auto ref = new JastrowWfn<double>(2.0);
+    auto wfn = new ADJastrowWfn<double, SimpleJastrow<double>>(SimpleJastrow<double>{2.0});
+    double val, derv2_f1, derv2_f2, ref2_f1, ref2_f2;
+    Eigen::Matrix<double, 1, 3> derv_f1, derv_f2, ref_f1, ref_f2;
+    wfn->evaluate(r1, r2, val, derv_f1, derv_f2, derv2_f1, derv2_f2);
+    std::tie(ref_f1, ref_f2) = ref->grad(r1, r2);
+    std::tie(ref2_f1, ref2_f2) = ref->laplace(r1, r2);
+    ASSERT_NEAR(val, ref->value(r1, r2), 1e-12);
+    ASSERT_NEAR(wfn->value(r1, r2), ref->value(r1, r2), 1e-12);
+    ASSERT_NEAR((derv_f1 - ref_f1).norm(), 0.0, 1e-12);
+    ASSERT_NEAR((derv_f2 - ref_f2).norm(), 0.0, 1e-12);
+    ASSERT_NEAR(derv2_f1, ref2_f1, 1e-10);
+    ASSERT_NEAR(derv2_f2, ref2_f2, 1e-10);
+    delete wfn;
+    delete ref;
+}
+
+template<JastrowType J, AtomicWfnType A>
+void check_batch() {
+    Eigen::Matrix<double, 1, 3> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    H2Mol<double, J, A> mol(JastrowParam<double>(1.0, 0.4, 0.8), 0.3, 1.1, R1, R2);
+    int n = 17;
+    BCoord<double> r1(n), r2(n);
+    for(int i=0; i<n; i++) {
+        r1.set_row(i, 2.0*Eigen::Matrix<double, 1, 3>::Random());
+        r2.set_row(i, 2.0*Eigen::Matrix<double, 1, 3>::Random());
+    }
+    BArray<double> density, energy;
+    mol.density_batch(r1, r2, density);
+    mol.energy_batch(r1, r2, energy);
+    for(int i=0; i<n; i++) {
+        ASSERT_NEAR(density(i), mol.density(r1.row(i), r2.row(i)), 1e-12);
+        ASSERT_NEAR(energy(i), mol.energy(r1.row(i), r2.row(i)), 1e-9);
+    }
+}
+
+TEST(H2Mol, Batch) {
+    check_batch<JastrowType::SIMPLE_JASTROW, AtomicWfnType::MO>();
+    check_batch<JastrowType::PADE_JASTROW, AtomicWfnType::VB>();
+    check_batch<JastrowType::EN_PADE_JASTROW, AtomicWfnType::MO>();
+}
+
+TEST(NaiveQMC, Batch) {
+    NaiveQMC<double> qmc(0.2, 0.9, 1.0);
+    qmc.seed(42);
+    auto single = qmc.sample(400000);
+    auto batch = qmc.sample_batch(64, 6250);
+    ASSERT_NEAR(single.first, batch.first, 0.01);
+    ASSERT_NEAR(single.second, batch.second, 0.05);
+}
+
+// log_derivs() against the defaults built from value/grad/laplace
+void check_log(PairWaveFn<double>* wfn) {
+    Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random();
+    Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random();
+    Eigen::Matrix<double, 1, 3> g1, g2, ref1, ref2;
+    double l1, l2, lref1, lref2;
+    wfn->log_derivs(r1, r2, g1, g2, l1, l2);
+    wfn->PairWaveFn<double>::log_derivs(r1, r2, ref1, ref2, lref1, lref2);
+    ASSERT_NEAR(wfn->log_value(r1, r2), std::log(wfn->value(r1, r2)), 1e-12);
+    ASSERT_NEAR((g1 - ref1).norm(), 0.0, 1e-10);
+    ASSERT_NEAR((g2 - ref2).norm(), 0.0, 1e-10);
+    ASSERT_NEAR(l1, lref1, 1e-10);
+    ASSERT_NEAR(l2, lref2, 1e-10);
+    delete wfn;
+}
+
+TEST(PairWaveFn, LogDomain) {
+    Eigen::Matrix<double, 1, 3> R1 = Eigen::Matrix<double, 1, 3>::Random();
+    Eigen::Matrix<double, 1, 3> R2 = Eigen::Matrix<double, 1, 3>::Random();
+    check_log(new JastrowWfn<double>(0.8));
+    check_log(new PadeJastrowWfn<double>(0.4, 0.9));
+    check_log(new ENPadeJastrowWfn<double>(0.9, 0.3, 1.2, R1, R2));
+}
+
+TEST(H2Mol, LogDomain) {
+    Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random();
+    Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random();
+    Eigen::Matrix<double, 1, 3> R1, R2, g, ref;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    double l, lref;
+    VBWaveFn<double> vb(0.3, 1.1, R1, R2);
+    vb.log_derivs(r1, g, l);
+    vb.WaveFn<double>::log_derivs(r1, ref, lref);
+    ASSERT_NEAR(vb.log_value(r1), std::log(vb.value(r1)), 1e-12);
+    ASSERT_NEAR((g - ref).norm(), 0.0, 1e-10);
+    ASSERT_NEAR(l, lref, 1e-10);
+    H2Mol<double, JastrowType::PADE_JASTROW, AtomicWfnType::MO> mol(JastrowParam<double>(1.0, 0.4, 0.8),
+                                                                     0.3, 1.1, R1, R2);
+    ASSERT_NEAR(mol.logpsi(r1, r2), 0.5*std::log(mol.density(r1, r2)), 1e-12);
+}
+
+TEST(H2Mol, EnergyComponents) {
+    Eigen::Matrix<double, 1, 3> r1 = Eigen::Matrix<double, 1, 3>::Random();
+    Eigen::Matrix<double, 1, 3> r2 = Eigen::Matrix<double, 1, 3>::Random();
+    Eigen::Matrix<double, 1, 3> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    H2Mol<double, JastrowType::PADE_JASTROW, AtomicWfnType::MO> mol(JastrowParam<double>(1.0, 0.5, 0.8),
+                                                                     0.0, 1.0, R1, R2);
+    auto e = mol.energy_components(r1, r2);
+    ASSERT_NEAR(e.total(), mol.energy(r1, r2), 1e-12);
+    ASSERT_NEAR(e.nuclear_nuclear, 1/1.4, 1e-12);
+    ASSERT_NEAR(e.electron_electron, 1/(r1 - r2).norm(), 1e-12);
+}
+
+TEST(Estimator, Walkers) {
+    Eigen::Matrix<double, 1, 3> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    typedef H2MolQMC<double>::Mol Mol;
+    H2MolQMC<double> qmc(1.0, 0.0, 1.0, R1, R2, 1.0);
+    qmc.set_verbose(false);
+    qmc.seed(7);
+    BondDensity<Mol> density(200, 6.0);
+    PairCorrelation<Mol> pair(200, 10.0);
+    EnergyEstimator<Mol> components;
+    auto ret = qmc.sample_walkers(64, 2000, 2, {&density, &pair, &components}, 4);
+    // every walker of both threads is sampled every 4 steps
+    std::ostringstream os;
+    components.write(os);
+    ASSERT_NE(os.str().find("32000 samples"), std::string::npos);
+    ASSERT_NEAR(components.mean(4), ret.first, 0.02);
+    // both normalized histograms integrate to the number of particles
+    auto integrate = [](const std::string& text, int column) {
+        std::istringstream is(text);
+        std::string line;
+        std::vector<double> x, y;
+        while(std::getline(is, line)) {
+            // skip the title and the column names
+            if(line.empty() || line[0] == '#' || std::isalpha(line[line.find_first_not_of(" \t")])) continue;
+            std::istringstream ls(line);
+            std::vector<double> cols(3);
+            for(int i=0; i<=column; i++) ls >> cols[i];
+            x.push_back(cols[0]);
+            y.push_back(cols[column]);
+        }
+        return std::accumulate(y.begin(), y.end(), 0.0)*(x[1] - x[0]);
+    };
+    std::ostringstream dos, pos;
+    density.write(dos);
+    pair.write(pos);
+    ASSERT_NEAR(integrate(dos.str(), 1), 2.0, 0.01);
+    ASSERT_NEAR(integrate(pos.str(), 1), 1.0, 0.01);
+}
+
+// counts the samples that came without the components of the sampler
+template<typename Mol>
+class MissingComponents: public Estimator<Mol> {
+public:
+    typedef typename Estimator<Mol>::Coord Coord;
+    typedef typename Estimator<Mol>::Components Components;
+
+    void accumulate(Mol&, const Coord&, const Coord&, const Components* e=nullptr) {
+        missing += e ? 0 : 1;
+    }
+
+    Estimator<Mol>* clone() const {
+        return new MissingComponents();
+    }
+
+    void merge(const Estimator<Mol>& other) {
+        missing += static_cast<const MissingComponents&>(other).missing;
+    }
+
+    void write(std::ostream&) const {}
+
+    long missing = 0;
+};
+
+TEST(Estimator, WalkerComponents) {
+    // the estimators get the components cached in the pool, every step they
+    // see exactly the energies of the sampler
+    Eigen::Matrix<double, 1, 3> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    typedef H2MolQMC<double, JastrowType::SIMPLE_JASTROW>::Mol Mol;
+    H2MolQMC<double, JastrowType::SIMPLE_JASTROW> qmc(JastrowParam<double>(1.0), 0.0, 1.0, R1, R2, 1.0);
+    qmc.set_verbose(false);
+    qmc.seed(7);
+    EnergyEstimator<Mol> components;
+    MissingComponents<Mol> missing;
+    auto ret = qmc.sample_walkers(32, 500, 2, {&components, &missing}, 1);
+    ASSERT_EQ(missing.missing, 0);
+    ASSERT_NEAR(components.mean(4), ret.first, 1e-10);
+    ASSERT_NEAR(components.mean(3), 1/1.4, 1e-12);
+    ASSERT_NEAR(components.mean(0) + components.mean(1) + components.mean(2) + components.mean(3), ret.first, 1e-10);
+}
+
+TEST(Estimator, Sample) {
+    Eigen::Matrix<double, 1, 3> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    typedef H2MolQMC<double>::Mol Mol;
+    H2MolQMC<double> qmc(1.0, 0.0, 1.0, R1, R2, 1.0);
+    qmc.set_verbose(false);
+    qmc.seed(7);
+    EnergyEstimator<Mol> components;
+    // the estimator takes the local energies of the sampler, the same samples
+    auto ret = qmc.sample(5000, {&components}, 1);
+    ASSERT_NEAR(components.mean(4), ret.first, 1e-12);
+    ASSERT_NEAR(components.stddev(4), ret.second, 1e-8);
+    ASSERT_THROW(qmc.sample(10, {&components}, 0), std::invalid_argument);
+    ASSERT_THROW(qmc.sample_walkers(4, 10, 1, {&components}, 0), std::invalid_argument);
+}
+
+TEST(ResultCache, Blocks) {
+    NaiveQMC<double> qmc(0.1, 1.0, 1.0);
+    qmc.seed(3);
+    qmc.set_block(100);
+    auto ret = qmc.sample(1050);
+    // 10 full blocks and the rest
+    ASSERT_EQ(qmc.blocks().size(), 11u);
+    ASSERT_EQ(qmc.blocks().back().steps, 50);
+    auto summary = summarize(qmc.blocks());
+    ASSERT_EQ(summary.steps, 1050);
+    ASSERT_NEAR(summary.mean, ret.first, 1e-12);
+    ASSERT_NEAR(summary.std, ret.second, 1e-10);
+    ASSERT_GT(summary.error, 0.0);
+    ASSERT_EQ(summarize(qmc.blocks(), 250).steps, 300);
+    // one block for the whole run without a block size
+    qmc.set_block(0);
+    ret = qmc.sample(500);
+    ASSERT_EQ(qmc.blocks().size(), 1u);
+    summary = summarize(qmc.blocks());
+    ASSERT_EQ(summary.steps, 500);
+    ASSERT_NEAR(summary.mean, ret.first, 1e-12);
+}
+
+TEST(ResultCache, Store) {
+    std::string path = "test_result_cache.bin";
+    std::remove(path.c_str());
+    CacheKey key("test", "hydrogen", 5), other("test", "hydrogen", 6);
+    key.add("c", 0.1).add("alpha", 1.0);
+    other.add("c", 0.1).add("alpha", 1.0);
+    auto runs = 0;
+    auto run = [&](long n, unsigned seed) -> std::vector<Block<double>> {
+        runs++;
+        NaiveQMC<double> qmc(0.1, 1.0, 1.0);
+        qmc.seed(seed);
+        qmc.set_block(100);
+        qmc.sample(n);
+        return qmc.blocks();
+    };
+    std::string status;
+    BlockSummary<double> first, again, longer;
+    {
+        ResultCache cache(path);
+        first = cached_run(&cache, key, 1000, run, status);
+        ASSERT_EQ(status, "new");
+        again = cached_run(&cache, key, 1000, run, status);
+        ASSERT_EQ(status, "hit");
+        ASSERT_EQ(runs, 1);
+        ASSERT_EQ(again.mean, first.mean);
+        ASSERT_EQ(again.error, first.error);
+        cached_run(&cache, other, 1000, run, status);
+        ASSERT_EQ(status, "new");
+    }
+    // reopened, the longer run keeps the stored blocks and adds 1000 steps
+    ResultCache cache(path);
+    ASSERT_EQ(cache.size(), 2u);
+    longer = cached_run(&cache, key, 2000, run, status);
+    ASSERT_EQ(status, "extended");
+    ASSERT_EQ(runs, 3);
+    ASSERT_EQ(longer.steps, 2000);
+    std::vector<Block<double>> blocks;
+    ASSERT_TRUE(cache.lookup(key, blocks));
+    ASSERT_EQ(blocks.size(), 20u);
+    ASSERT_NEAR(summarize(blocks, 1000).mean, first.mean, 1e-12);
+    // a torn record at the end is skipped and overwritten
+    {
+        std::FILE* f = std::fopen(path.c_str(), "ab");
+        std::fputs("torn", f);
+        std::fclose(f);
+    }
+    ResultCache torn(path);
+    ASSERT_EQ(torn.size(), 2u);
+    cached_run(&torn, key, 3000, run, status);
+    ASSERT_EQ(status, "extended");
+    ResultCache reopened(path);
+    ASSERT_TRUE(reopened.lookup(key, blocks));
+    ASSERT_EQ(summarize(blocks).steps, 3000);
+    std::remove(path.c_str());
+}
+
+TEST(ResultCache, PartialBlock) {
+    std::string path = "test_result_cache_partial.bin";
+    std::remove(path.c_str());
+    CacheKey key("test", "hydrogen", 5);
+    key.add("c", 0.1).add("block", 100);
+    auto run = [&](long n, unsigned seed) -> std::vector<Block<double>> {
+        NaiveQMC<double> qmc(0.1, 1.0, 1.0);
+        qmc.seed(seed);
+        qmc.set_block(100);
+        qmc.sample(n);
+        return qmc.blocks();
+    };
+    std::string status;
+    ResultCache cache(path);
+    ASSERT_EQ(cached_run(&cache, key, 1050, run, status).steps, 1050);
+    ASSERT_EQ(status, "new");
+    ASSERT_EQ(cached_run(&cache, key, 1050, run, status).steps, 1050);
+    ASSERT_EQ(status, "hit");
+    // never more steps than asked for, the whole blocks are extended
+    ASSERT_EQ(cached_run(&cache, key, 1020, run, status).steps, 1020);
+    ASSERT_EQ(status, "extended");
+    ASSERT_EQ(cached_run(&cache, key, 1000, run, status).steps, 1000);
+    ASSERT_EQ(status, "hit");
+    // the shorter run does not replace the stored one
+    std::vector<Block<double>> blocks;
+    ASSERT_TRUE(cache.lookup(key, blocks));
+    ASSERT_EQ(summarize(blocks).steps, 1050);
+    std::remove(path.c_str());
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
-} 
\ No newline at end of file
+}
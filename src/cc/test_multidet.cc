@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "multidet.hpp"
+
+// s orbital centered at R
+class CenteredOrbital: public WaveFn<double> {
+public:
+    CenteredOrbital(double alpha, const PCoord<double>& R): phi(0.0, alpha), R(R) {}
+
+    double value(const PCoord<double>& r) {
+        return phi.value(r - R);
+    }
+
+    PCoord<double> grad(const PCoord<double>& r) {
+        return phi.grad(r - R);
+    }
+
+    double laplace(const PCoord<double>& r) {
+        return phi.laplace(r - R);
+    }
+
+private:
+    AtomicWaveFn<double> phi;
+    PCoord<double> R;
+};
+
+// every determinant from scratch
+double naive(const std::vector<WaveFn<double>*>& orbitals, const std::vector<CIDeterminant<double>>& dets,
+             const std::vector<PCoord<double>>& coords, int nup) {
+    double ret = 0.0;
+    for(auto& det: dets) {
+        Eigen::MatrixXd up(det.up.size(), det.up.size()), dn(det.dn.size(), det.dn.size());
+        for(size_t i=0; i<det.up.size(); i++) {
+            for(size_t j=0; j<det.up.size(); j++) up(i, j) = orbitals[det.up[j]]->value(coords[i]);
+        }
+        for(size_t i=0; i<det.dn.size(); i++) {
+            for(size_t j=0; j<det.dn.size(); j++) dn(i, j) = orbitals[det.dn[j]]->value(coords[nup + i]);
+        }
+        ret += det.coef*up.determinant()*dn.determinant();
+    }
+    return ret;
+}
+
+class MultiSlaterDetTest: public ::testing::Test {
+protected:
+    void SetUp() {
+        for(int i=0; i<8; i++) {
+            orbitals.push_back(new CenteredOrbital(0.6 + 0.1*i, 1.5*PCoord<double>::Random()));
+        }
+        for(int i=0; i<6; i++) coords.push_back(PCoord<double>::Random());
+        // reference, singles, doubles, a triple, a permuted copy and a repeated determinant
+        dets = {
+            {1.0, {0, 1, 2}, {0, 1, 2}},
+            {0.3, {0, 1, 3}, {0, 1, 2}},
+            {-0.2, {0, 1, 2}, {4, 1, 2}},
+            {0.1, {5, 1, 3}, {0, 6, 2}},
+            {0.05, {7, 6, 5}, {3, 4, 5}},
+            {0.07, {3, 0, 1}, {2, 1, 4}},
+            {-0.04, {0, 1, 3}, {4, 1, 2}},
+        };
+    }
+
+    void TearDown() {
+        for(auto o: orbitals) delete o;
+    }
+
+    std::vector<WaveFn<double>*> orbitals;
+    std::vector<PCoord<double>> coords;
+    std::vector<CIDeterminant<double>> dets;
+};
+
+TEST_F(MultiSlaterDetTest, Value) {
+    MultiSlaterDet<double> wfn(orbitals, 3, 3, dets);
+    ASSERT_EQ(wfn.unique(0), 4u);
+    ASSERT_EQ(wfn.unique(1), 4u);
+    auto ref = naive(orbitals, dets, coords, 3);
+    ASSERT_NEAR(wfn.evaluate(coords)/ref, 1.0, 1e-10);
+}
+
+TEST_F(MultiSlaterDetTest, Ratio) {
+    MultiSlaterDet<double> wfn(orbitals, 3, 3, dets);
+    wfn.evaluate(coords);
+    for(int step=0; step<60; step++) {
+        int e = step % 6;
+        PCoord<double> r = coords[e] + 0.5*PCoord<double>::Random();
+        auto old = naive(orbitals, dets, coords, 3);
+        auto ratio = wfn.ratio(e, r);
+        auto moved = coords;
+        moved[e] = r;
+        ASSERT_NEAR(ratio, naive(orbitals, dets, moved, 3)/old, 1e-8*std::max(1.0, std::abs(ratio)));
+        if(step % 3 != 2) {
+            wfn.accept();
+            coords = moved;
+        }
+    }
+    ASSERT_NEAR(wfn.value()/naive(orbitals, dets, coords, 3), 1.0, 1e-8);
+}
+
+TEST_F(MultiSlaterDetTest, Derivs) {
+    // against central differences of the determinants from scratch
+    MultiSlaterDet<double> wfn(orbitals, 3, 3, dets);
+    wfn.evaluate(coords);
+    const double h = 1e-4;
+    for(int step=0; step<12; step++) {
+        int e = step % 6;
+        auto psi = naive(orbitals, dets, coords, 3);
+        PCoord<double> grad, ngrad;
+        double lap, nlap = 0.0;
+        wfn.derivs(e, grad, lap);
+        for(int d=0; d<3; d++) {
+            auto plus = coords, minus = coords;
+            plus[e](d) += h;
+            minus[e](d) -= h;
+            auto fp = naive(orbitals, dets, plus, 3), fm = naive(orbitals, dets, minus, 3);
+            ngrad(d) = (fp - fm)/(2*h*psi);
+            nlap += (fp - 2*psi + fm)/(h*h*psi);
+        }
+        ASSERT_NEAR((grad - ngrad).norm(), 0.0, 1e-6*std::max(1.0, ngrad.norm()));
+        ASSERT_NEAR(lap, nlap, 1e-4*std::max(1.0, std::abs(nlap)));
+        // move the other spin, so that the sums over its ratios are stale
+        int other = (e + 3) % 6;
+        PCoord<double> r = coords[other] + 0.5*PCoord<double>::Random();
+        wfn.ratio(other, r);
+        wfn.accept();
+        coords[other] = r;
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "hydrogen.hpp"
+#include "simple_qmc.hpp"
+#include "telemetry.hpp"
+
+TEST(Telemetry, Summary) {
+    // the batches of the publications are the blocks of the result cache
+    Telemetry telemetry("test", 1, 10);
+    Blocking<double> blocking;
+    blocking.reset(10);
+    auto progress = telemetry.begin(1, 95);
+    std::mt19937 gen(7);
+    std::normal_distribution<double> dist(-0.5, 0.1);
+    for(int i=0; i<95; i++) {
+        auto e = dist(gen);
+        progress->add(e, e*e, 1, i % 2, 1, 0.8);
+        blocking.add(e, e*e, 1);
+    }
+    auto s = telemetry.summary();
+    ASSERT_EQ(s.steps, 90);
+    ASSERT_FALSE(s.done);
+    progress->finish();
+    s = telemetry.summary();
+    auto ref = summarize(blocking.blocks());
+    ASSERT_EQ(s.steps, 95);
+    ASSERT_EQ(s.target, 95);
+    ASSERT_TRUE(s.done);
+    ASSERT_EQ(s.runs, 1);
+    ASSERT_NEAR(s.mean, ref.mean, 1e-12);
+    ASSERT_NEAR(s.std, ref.std, 1e-12);
+    ASSERT_NEAR(s.error, ref.error, 1e-12);
+    ASSERT_NEAR(s.acceptance, 47.0/95, 1e-12);
+    ASSERT_DOUBLE_EQ(s.dr, 0.8);
+    ASSERT_THROW(telemetry.begin(2, 10), std::runtime_error);
+}
+
+TEST(Telemetry, Consistent) {
+    // every snapshot read while the sampler publishes is one publication
+    Telemetry telemetry("test", 1, 1);
+    auto progress = telemetry.begin(1, 200000);
+    std::atomic<bool> running{true};
+    std::thread writer([&]() {
+        for(int i=0; i<200000; i++) progress->add(2.0, 4.0, 3, 1, 3, 0.5);
+        progress->finish();
+        running = false;
+    });
+    long checked = 0;
+    while(running) {
+        auto s = telemetry.summary();
+        if(s.steps == 0) continue;
+        ASSERT_DOUBLE_EQ(s.mean, 2.0/3);
+        ASSERT_DOUBLE_EQ(s.acceptance, 1.0/3);
+        checked++;
+    }
+    writer.join();
+    ASSERT_GT(checked, 0);
+    ASSERT_EQ(telemetry.summary().steps, 200000);
+}
+
+TEST(Telemetry, File) {
+    auto path = fmt::format("/tmp/test_telemetry_{}.prom", getpid());
+    {
+        Telemetry telemetry("test", 1, 10);
+        telemetry.serve(path, "", 0.01);
+        auto progress = telemetry.begin(1, 100);
+        for(int i=0; i<100; i++) progress->add(-1.0, 1.0, 1, 1, 1, 1.0);
+        progress->finish();
+    }
+    // the last write at stop() sees the finished run
+    std::ifstream input(path);
+    std::stringstream text;
+    text << input.rdbuf();
+    ASSERT_NE(text.str().find("# TYPE qmc_steps gauge\n"), std::string::npos);
+    ASSERT_NE(text.str().find("qmc_steps{program=\"test\"} 100\n"), std::string::npos);
+    ASSERT_NE(text.str().find("qmc_energy{program=\"test\"} -1\n"), std::string::npos);
+    ASSERT_NE(text.str().find("qmc_done{program=\"test\"} 1\n"), std::string::npos);
+    ASSERT_FALSE(std::ifstream(path + ".tmp").good());
+    std::remove(path.c_str());
+}
+
+TEST(Telemetry, Socket) {
+    auto path = fmt::format("/tmp/test_telemetry_{}.sock", getpid());
+    Telemetry telemetry("test", 1, 10);
+    telemetry.serve("", path, 10.0);
+    auto progress = telemetry.begin(1, 100);
+    for(int i=0; i<50; i++) progress->add(-0.5, 0.25, 1, 0, 1, 1.0);
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    std::string text;
+    char buf[4096];
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0) text.append(buf, n);
+    close(fd);
+    ASSERT_NE(text.find("qmc_steps{program=\"test\"} 50\n"), std::string::npos);
+    ASSERT_NE(text.find("qmc_acceptance{program=\"test\"} 0\n"), std::string::npos);
+    ASSERT_NE(text.find("qmc_done{program=\"test\"} 0\n"), std::string::npos);
+    telemetry.stop();
+    ASSERT_NE(access(path.c_str(), F_OK), 0);
+}
+
+TEST(Telemetry, Samplers) {
+    PCoord<double> R1, R2;
+    R1 << 0.7, 0.0, 0.0;
+    R2 << -0.7, 0.0, 0.0;
+    Telemetry telemetry("test", 2, 100);
+    H2MolQMC<double, JastrowType::SIMPLE_JASTROW> h2qmc(JastrowParam<double>(1.0), 0.0, 1.0, R1, R2, 1.0);
+    h2qmc.set_verbose(false);
+    h2qmc.seed(3);
+    h2qmc.set_telemetry(&telemetry);
+    auto ret = h2qmc.sample(5000);
+    auto s = telemetry.summary();
+    ASSERT_EQ(s.steps, 5000);
+    ASSERT_TRUE(s.done);
+    ASSERT_NEAR(s.mean, ret.first, 1e-10);
+    ASSERT_NEAR(s.std, ret.second, 1e-8);
+    ASSERT_NEAR(s.acceptance, h2qmc.accept_ratio(), 1e-12);
+    ret = h2qmc.sample_walkers(8, 500, 2);
+    s = telemetry.summary();
+    ASSERT_EQ(s.runs, 2);
+    ASSERT_EQ(s.steps, 500);
+    ASSERT_NEAR(s.mean, ret.first, 1e-10);
+    ASSERT_NEAR(s.acceptance, h2qmc.accept_ratio(), 1e-12);
+
+    NaiveQMC<double> naive(0.0, 1.0, 1.0);
+    naive.seed(3);
+    naive.set_telemetry(&telemetry);
+    ret = naive.sample_batch(16, 1000);
+    s = telemetry.summary();
+    ASSERT_EQ(s.steps, 1000);
+    ASSERT_NEAR(s.mean, ret.first, 1e-10);
+    ASSERT_NEAR(s.acceptance, naive.accept_ratio(), 1e-12);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <Eigen/Dense>
+
+// Bump allocator over one page aligned block. Allocations are never
+// freed one by one, the whole block is released with the arena. The pages
+// are not touched here, so they are placed by the thread that writes them first
+class Arena {
+public:
+    static const size_t alignment = 64;
+    static const size_t page = 4096;
+
+    Arena(size_t capacity): capacity(round_up(capacity)) {
+        void* ptr = nullptr;
+        if(posix_memalign(&ptr, page, this->capacity) != 0) throw std::bad_alloc();
+        data = static_cast<char*>(ptr);
+    }
+
+    ~Arena() {
+        std::free(data);
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // n uninitialized objects starting on a cache line, or on a page
+    template<typename T>
+    T* allocate(size_t n, size_t align=alignment) {
+        auto start = (offset + align - 1)/align*align;
+        auto bytes = round_up(n*sizeof(T));
+        if(start + bytes > capacity) throw std::bad_alloc();
+        auto ret = reinterpret_cast<T*>(data + start);
+        offset = start + bytes;
+        return ret;
+    }
+
+    void reset() {
+        offset = 0;
+    }
+
+    size_t used() const {
+        return offset;
+    }
+
+    static size_t round_up(size_t bytes) {
+        return (bytes + alignment - 1)/alignment*alignment;
+    }
+
+private:
+    char* data = nullptr;
+    size_t capacity;
+    size_t offset = 0;
+};
+
+// Fill arr with uniform numbers in [lo, hi) for a block of walkers. One 64-bit
+// draw per number, about 3x cheaper than std::uniform_real_distribution on
+// std::mt19937, which needs two draws per double and dominates a batched step
+template<typename Array>
+void uniform_fill(std::mt19937_64& gen, Array&& arr, double lo, double hi) {
+    const double scale = (hi - lo)/9007199254740992.0; // 2^53
+    for(Eigen::Index i=0; i<arr.size(); i++) arr(i) = lo + scale*(gen() >> 11);
+}
+
+// Walkers of nelec electrons in structure-of-arrays layout: the coordinate d
+// of electron e of all the walkers is the contiguous array pos(e, d), followed
+// by the cached wave function value ln|psi|, the local energy and its components.
+// All arrays live in an Arena, so adding, copying and removing walkers is
+// O(1) without heap traffic. A pool of at least a page of walkers starts
+// every array on a page, so that slices cut on pages own whole pages.
+template<typename T>
+class WalkerPool {
+public:
+    static const size_t line = Arena::alignment/sizeof(T);
+    static const size_t page = Arena::page/sizeof(T);
+    static const int ncomponent = 3; // of the local energy, e.g. kinetic, e-n, e-e
+    static const int narray_extra = 2 + ncomponent; // logpsi, eloc, components
+    typedef Eigen::Matrix<T, 1, 3> Coord;
+
+    WalkerPool(Arena& arena, int nelec, size_t capacity):
+        nelec(nelec), cap(padded(capacity)) {
+        data = arena.allocate<T>(narray()*cap, cap % page == 0 ? Arena::page : Arena::alignment);
+    }
+
+    // bytes of the arena needed for the pool, with the padding to a page
+    static size_t bytes(int nelec, size_t capacity) {
+        auto cap = padded(capacity);
+        return (cap % page == 0 ? Arena::page : 0) + Arena::round_up((3*nelec + narray_extra)*cap*sizeof(T));
+    }
+
+    size_t size() const {
+        return n;
+    }
+
+    size_t capacity() const {
+        return cap;
+    }
+
+    int electrons() const {
+        return nelec;
+    }
+
+    inline T* pos(int e, int d) {
+        return data + (3*e + d)*cap;
+    }
+
+    inline Coord position(size_t w, int e) const {
+        const T* p = data + 3*e*cap + w;
+        return Coord(p[0], p[cap], p[2*cap]);
+    }
+
+    inline void set_position(size_t w, int e, const Coord& r) {
+        T* p = data + 3*e*cap + w;
+        p[0] = r(0);
+        p[cap] = r(1);
+        p[2*cap] = r(2);
+    }
+
+    // cached ln|psi| of the walker
+    inline T& logpsi(size_t w) {
+        return data[3*nelec*cap + w];
+    }
+
+    // cached local energy of the walker
+    inline T& eloc(size_t w) {
+        return data[(3*nelec + 1)*cap + w];
+    }
+
+    // cached component k of the local energy of the walker
+    inline T& component(int k, size_t w) {
+        return data[(3*nelec + 2 + k)*cap + w];
+    }
+
+    // append an uninitialized walker, return its index
+    size_t add() {
+        if(n == cap) throw std::length_error("WalkerPool is full");
+        return n++;
+    }
+
+    // append a copy of walker w (e.g. branching in DMC), return its index
+    size_t copy(size_t w) {
+        auto ret = add();
+        for(int i=0; i<narray(); i++) data[i*cap + ret] = data[i*cap + w];
+        return ret;
+    }
+
+    // remove walker w by moving the last walker into its place
+    void remove(size_t w) {
+        n--;
+        if(w == n) return;
+        for(int i=0; i<narray(); i++) data[i*cap + w] = data[i*cap + n];
+    }
+
+    void clear() {
+        n = 0;
+    }
+
+    // whether the slices of nthread threads own whole pages of every array,
+    // i.e. the pool is page aligned and has at least a page per thread
+    bool paged(int nthread) const {
+        return cap % page == 0 && n >= nthread*page;
+    }
+
+    // [begin, end) of the walkers owned by thread tid, cut on pages when
+    // paged(nthread), else on cache lines, the first threads taking the rest
+    std::pair<size_t, size_t> slice(int tid, int nthread) const {
+        size_t unit = line;
+        if(paged(nthread)) unit = page;
+        auto units = (n + unit - 1)/unit;
+        auto begin = std::min((tid*units + nthread - 1)/nthread*unit, n);
+        auto end = std::min(((tid + 1)*units + nthread - 1)/nthread*unit, n);
+        return {begin, end};
+    }
+
+    // Zero the slice [begin, end) of all arrays from the calling thread, so that
+    // with the first-touch policy its pages are placed on the thread's NUMA node.
+    // Pages shared by slices go to whichever thread is first, so a pool that is
+    // not paged() is better touched whole by a single owner
+    void touch(size_t begin, size_t end) {
+        for(int i=0; i<narray(); i++) {
+            std::memset(data + i*cap + begin, 0, (end - begin)*sizeof(T));
+        }
+    }
+
+private:
+    int nelec;
+    size_t cap;
+    size_t n = 0;
+    T* data;
+
+    inline int narray() const {
+        return 3*nelec + narray_extra;
+    }
+
+    // capacity rounded to cache lines, or to pages from one page on
+    static size_t padded(size_t capacity) {
+        size_t unit = line;
+        if(capacity >= page) unit = page;
+        return (capacity + unit - 1)/unit*unit;
+    }
+};